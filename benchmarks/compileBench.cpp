@@ -0,0 +1,138 @@
+#include "compiler.h"
+#include "memory.h"
+#include "source.h"
+#include "vm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Loading a script of many top-level functions of which few are called: compiled eagerly from a string, or from a
+// Source, where each body is only skipped at load time and compiled on its first call.
+
+// NOTE: a script has room for about 120 functions, each takes two of its constants
+static const int FUNCTION_COUNTS[] = {10, 50, 100};
+static const int CALLED_PERCENT = 10;
+
+static double
+secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string
+makeScript(int functionCount) {
+  std::string script;
+  char line[256];
+  for (int i = 0; i < functionCount; i++) {
+    snprintf(line, sizeof(line),
+             "fun f%d(a, b) {\n"
+             "  var sum = 0;\n"
+             "  for (var i = 0; i < a; i = i + 1) {\n"
+             "    if (i > b and i < %d) { sum = sum + i * 2; } else { sum = sum - 1; }\n"
+             "    while (sum > 1000) { sum = sum / 2; }\n"
+             "  }\n"
+             "  var name = \"f%d\";\n"
+             "  return [sum, name, b];\n"
+             "}\n",
+             i, i, i);
+    script += line;
+  }
+  return script;
+}
+
+/**
+ * Compile `script` and report the best time taken and the heap it leaves behind; `deferred` compiles it through a
+ * Source.
+ */
+static void
+benchLoad(const std::string& script, int functionCount, bool deferred) {
+  initVM();
+  vm.nextGC = SIZE_MAX;
+  const size_t before = vm.bytesAllocated;
+
+  FILE* file = tmpfile();
+  fputs(script.c_str(), file);
+  rewind(file);
+  Source source;
+  openSourceStream(&source, file);
+  while (refillSource(&source)) {
+    // Read it all before the clock starts.
+  }
+
+  const int rounds = 20000 / functionCount;
+  double seconds = 1e9;
+  size_t retained = 0;
+  for (int round = 0; round < rounds; round++) {
+    auto start = std::chrono::steady_clock::now();
+    ObjFunction* function = deferred ? compile(&source) : compile(script.c_str());
+    seconds = std::min(seconds, secondsSince(start));
+    if (function == nullptr) {
+      fprintf(stderr, "compile error\n");
+      exit(1);
+    }
+    retained = vm.bytesAllocated - before;
+    collectGarbage();
+    finishSweep();
+  }
+  closeSource(&source);
+  fclose(file);
+
+  printf("load  %-8s %6d functions  %9.3f ms  %10zu bytes\n", deferred ? "deferred" : "eager", functionCount,
+         seconds * 1e3, retained);
+  freeVM();
+}
+
+/**
+ * Load `script` and call every CALLED_PERCENT-th function once; report the best time.
+ */
+static void
+benchRun(const std::string& script, int functionCount, bool deferred) {
+  std::string run = script;
+  char line[64];
+  for (int i = 0; i < functionCount; i += 100 / CALLED_PERCENT) {
+    snprintf(line, sizeof(line), "f%d(10, 3);\n", i);
+    run += line;
+  }
+
+  FILE* file = tmpfile();
+  fputs(run.c_str(), file);
+  const int rounds = 20000 / functionCount;
+  double seconds = 1e9;
+  for (int round = 0; round < rounds; round++) {
+    initVM();
+    rewind(file);
+    Source source;
+    openSourceStream(&source, file);
+    while (refillSource(&source)) {
+      // Read it all before the clock starts.
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    const InterpretResult result = deferred ? interpret(&source) : interpret(run.c_str());
+    seconds = std::min(seconds, secondsSince(start));
+    closeSource(&source);
+    freeVM();
+    if (result != InterpretResult::INTERPRET_OK) {
+      fprintf(stderr, "run error\n");
+      exit(1);
+    }
+  }
+  fclose(file);
+
+  printf("run   %-8s %6d functions  %9.3f ms  (%d%% called)\n", deferred ? "deferred" : "eager", functionCount,
+         seconds * 1e3, CALLED_PERCENT);
+}
+
+int
+main() {
+  for (int functionCount : FUNCTION_COUNTS) {
+    const std::string script = makeScript(functionCount);
+    benchLoad(script, functionCount, false);
+    benchLoad(script, functionCount, true);
+    benchRun(script, functionCount, false);
+    benchRun(script, functionCount, true);
+  }
+  return 0;
+}
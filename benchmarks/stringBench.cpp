@@ -0,0 +1,88 @@
+#include "object.h"
+#include "vm.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Throughput of hashString() and of interning through copyString(), over a range of string lengths.
+
+static const int LENGTHS[] = {3, 8, 16, 32, 64, 256, 1024, 16384};
+
+static double
+secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void
+fillRandom(char* buffer, int length) {
+  for (int i = 0; i < length; i++) {
+    buffer[i] = (char)('a' + rand() % 26);
+  }
+}
+
+static void
+benchHash(int length) {
+  const int count = 1 << 12;
+  char* buffer = (char*)malloc((size_t)length + count);
+  fillRandom(buffer, length + count);
+
+  const size_t budget = size_t{256} << 20;
+  const size_t rounds = budget / ((size_t)length * count) + 1;
+  uint32_t sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; round++) {
+    for (int i = 0; i < count; i++) {
+      sink += hashString(buffer + i, length);
+    }
+  }
+  const double seconds = secondsSince(start);
+  const double hashes = (double)rounds * count;
+
+  printf("hash    %6d bytes  %8.2f Mhash/s  %8.2f GB/s  (%08x)\n", length, hashes / seconds / 1e6,
+         hashes * length / seconds / 1e9, sink);
+  free(buffer);
+}
+
+static void
+benchIntern(int length) {
+  const int count = length <= 64 ? 100000 : 10000;
+  char* buffer = (char*)malloc((size_t)length + count);
+  fillRandom(buffer, length + count);
+
+  // The first pass allocates a new string per call, the second finds every one of them interned.
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    push(OBJ_VAL(copyString(buffer + i, length)));
+    pop();
+  }
+  const double fresh = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    copyString(buffer + i, length);
+  }
+  const double found = secondsSince(start);
+
+  printf("intern  %6d bytes  %8.2f Mnew/s   %8.2f Mfound/s\n", length, count / fresh / 1e6, count / found / 1e6);
+  free(buffer);
+}
+
+int
+main() {
+  initVM();
+  // Keep the collector out of the interning numbers.
+  vm.nextGC = SIZE_MAX;
+
+  for (int length : LENGTHS) {
+    benchHash(length);
+  }
+  for (int length : LENGTHS) {
+    benchIntern(length);
+  }
+
+  freeVM();
+  return 0;
+}
@@ -4,8 +4,28 @@
 
 void
 Chunk::writeChunk(uint8_t byte, int line) {
+  const int offset = this->code.count;
   this->code.push(byte);
-  this->lines.push(line);
+
+  if (this->lines.count > 0 && this->lines.items[this->lines.count - 1].line == line) {
+    return;
+  }
+  this->lines.push(LineStart{offset, line});
+}
+
+int
+Chunk::getLine(int offset) const {
+  int low = 0;
+  int high = this->lines.count - 1;
+  while (low < high) {
+    const int mid = low + (high - low + 1) / 2;
+    if (this->lines.items[mid].offset <= offset) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return this->lines.items[low].line;
 }
 
 int
@@ -16,6 +36,24 @@ Chunk::addConstant(Value value) {
   return idx;
 }
 
+uint8_t
+Chunk::addBindingCache() {
+  if (this->bindings.count == lims::UINT8_VAL_COUNT) {
+    return (uint8_t)(lims::UINT8_VAL_COUNT - 1);
+  }
+  this->bindings.push(BindingCache{nullptr, 0, false});
+  return (uint8_t)(this->bindings.count - 1);
+}
+
+uint8_t
+Chunk::addSuperCache() {
+  if (this->superCaches.count == lims::UINT8_VAL_COUNT) {
+    return (uint8_t)(lims::UINT8_VAL_COUNT - 1);
+  }
+  this->superCaches.push(SuperCache{nullptr, nullptr, nullptr});
+  return (uint8_t)(this->superCaches.count - 1);
+}
+
 int
 Chunk::getCount() const {
   return this->code.count;
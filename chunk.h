@@ -6,6 +6,10 @@
 
 #include <cstdio>
 
+struct ObjBoundMethod;
+struct ObjClass;
+struct ObjClosure;
+
 enum class OpCode : uint8_t {
   OP_CONSTANT,
   OP_NIL,
@@ -22,6 +26,10 @@ enum class OpCode : uint8_t {
   OP_GET_PROPERTY,
   OP_SET_PROPERTY,
   OP_GET_SUPER,
+  OP_BUILD_LIST,
+  OP_BUILD_MAP,
+  OP_INDEX_GET,
+  OP_INDEX_SET,
   OP_EQUAL,
   OP_GREATER,
   OP_LESS,
@@ -46,6 +54,15 @@ enum class OpCode : uint8_t {
   OP_METHOD,
 };
 
+/**
+ * How OP_CLOSURE gets each upvalue, the first of the two bytes that follow it per upvalue.
+ */
+enum class Capture : uint8_t {
+  CAPTURE_UPVALUE, // the enclosing closure's upvalue
+  CAPTURE_LOCAL,   // an enclosing local, shared with its frame until the local goes out of scope
+  CAPTURE_VALUE,   // the value of an enclosing local that is never assigned, copied into an upvalue that starts closed
+};
+
 inline OpCode
 u8ToOpCode(uint8_t i) {
   return static_cast<OpCode>(i);
@@ -56,20 +73,72 @@ opCodeToU8(OpCode code) {
   return static_cast<uint8_t>(code);
 }
 
+/**
+ * One run of the line table: every byte from `offset` up to the offset of the next run was compiled from `line`.
+ */
+struct LineStart {
+  int offset;
+  int line;
+};
+
+/**
+ * What an OP_GET_SUPER or OP_SUPER_INVOKE site found last: `method` is the method `name` of `superclass`. A class's
+ * methods do not change once its body has run, so the entry holds for as long as the site sees the same superclass.
+ */
+struct SuperCache {
+  ObjClass* superclass; // nullptr in an empty entry
+  ObjString* name;
+  ObjClosure* method;
+};
+
+/**
+ * What an OP_GET_PROPERTY or OP_GET_SUPER site bound last. A site is `reusable` when the compiler found that its bound
+ * method only ever goes to one local that is called and nothing else: once that local no longer holds it, the site
+ * rebinds it in place instead of making another.
+ */
+struct BindingCache {
+  ObjBoundMethod* bound; // nullptr in an empty entry
+  int slot;              // the stack slot `bound` was left in
+  bool reusable;
+};
+
 class Chunk {
 public:
   void
   writeChunk(uint8_t byte, int line);
 
+  /**
+   * Binary search the run-length encoded line table for the source line of the byte at `offset`.
+   */
+  int
+  getLine(int offset) const;
+
   int
   addConstant(Value value);
 
+  /**
+   * A slot of `bindings` for one more site that binds methods; sites past the 256th share the last slot.
+   */
+  uint8_t
+  addBindingCache();
+
+  /**
+   * A slot of `superCaches` for one more super call site; sites past the 256th share the last slot.
+   */
+  uint8_t
+  addSuperCache();
+
   int
   getCount() const;
 
   Vec<uint8_t> code;
-  Vec<int> lines;
+  Vec<LineStart> lines;
   ValueArray constants;
+  // Per OP_GET_PROPERTY and OP_GET_SUPER site, the bound method a reusable site made last. The entries are weak:
+  // marking the function clears them.
+  Vec<BindingCache> bindings;
+  // Per OP_GET_SUPER and OP_SUPER_INVOKE site, the method it resolved last. Weak like `bindings`.
+  Vec<SuperCache> superCaches;
 };
 
 #endif
@@ -10,6 +10,9 @@ public:
   void
   push(T item);
 
+  T
+  pop();
+
   T*
   beginning();
 
@@ -37,15 +40,23 @@ template <typename T>
 void
 Vec<T>::push(T item) {
   if (this->capacity < this->count + 1) {
-    const int oldCapacity = this->capacity;
-    this->capacity = GROW_CAPACITY(oldCapacity);
-    this->items = GROW_ARRAY(T, this->items, oldCapacity, this->capacity);
+    // NOTE: the capacity changes only once the array did: growing may collect, or throw OutOfMemory
+    const int newCapacity = GROW_CAPACITY(this->capacity);
+    this->items = GROW_ARRAY(T, this->items, this->capacity, newCapacity);
+    this->capacity = newCapacity;
   }
 
   this->items[this->count] = item;
   this->count += 1;
 }
 
+template <typename T>
+T
+Vec<T>::pop() {
+  this->count -= 1;
+  return this->items[this->count];
+}
+
 template <typename T>
 T*
 Vec<T>::beginning() {
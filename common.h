@@ -5,10 +5,27 @@
 #include <cstddef>
 #include <cstdint>
 
+/**
+ * Index of the lowest set bit of `bits`, which must not be 0.
+ */
+inline int
+lowestBit(uint64_t bits) {
+#ifdef __GNUC__
+  return __builtin_ctzll(bits);
+#else
+  int bit = 0;
+  while (((bits >> bit) & 1) == 0) {
+    bit++;
+  }
+  return bit;
+#endif
+}
+
 #define NAN_BOXING
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
 
+// #define DEBUG_PROFILE
 // #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
 
@@ -52,6 +52,9 @@ struct Local {
   Token name;
   int depth;
   bool isCaptured;
+  bool isAssigned; // after its declaration, here or in a closure
+  bool isRead;     // other than as the callee of a call
+  int binding;     // the Chunk::bindings slot of the method read it was initialized with, or -1
 };
 
 struct Upvalue {
@@ -75,6 +78,15 @@ struct Compiler {
   int localCount;
   Upvalue upvalues[lims::UINT8_VAL_COUNT];
   int scopeDepth;
+
+  // Offsets of the Capture::CAPTURE_LOCAL bytes whose local is still in scope. When it goes out of scope unassigned,
+  // they become Capture::CAPTURE_VALUE.
+  int captureSites[lims::UINT8_VAL_COUNT];
+  int captureSiteCount;
+
+  // The Chunk::bindings slot of the last method read, and the offset just past it.
+  int lastBinding;
+  int lastBindingEnd;
 };
 
 struct ClassCompiler {
@@ -85,6 +97,8 @@ struct ClassCompiler {
 Parser parser;
 Compiler* current = nullptr;
 ClassCompiler* currentClass = nullptr;
+// Whether top-level function bodies may be left for compileFunctionBody(); only for scripts compiled from a Source.
+bool deferBodies = false;
 
 static Chunk*
 currentChunk() {
@@ -176,7 +190,7 @@ emitBytes(OpCode byte1, uint8_t byte2) {
 
 static void
 emitLoop(int loopStart) {
-  emitByte(OpCode::OP_POP);
+  emitByte(OpCode::OP_LOOP);
 
   int offset = currentChunk()->getCount() - loopStart + 2;
   if (offset > UINT16_MAX) {
@@ -217,9 +231,39 @@ makeConstant(Value value) {
   return (uint8_t)constantIdx;
 }
 
+/**
+ * The local in `slot` goes out of scope. Its closures can copy its value when it was never assigned; true if they do.
+ * A bound method it was initialized with can be reused once it is gone when it was only ever called.
+ */
+static bool
+endLocal(int slot) {
+  const Local* local = &(current->locals[slot]);
+  const bool copied = local->isCaptured && !local->isAssigned;
+
+  Chunk* chunk = currentChunk();
+  if (local->binding != -1 && !local->isRead && !local->isAssigned && !local->isCaptured) {
+    chunk->bindings[local->binding].reusable = true;
+  }
+
+  // NOTE: drop the sites either way, a later local may get the same slot
+  for (int i = 0; i < current->captureSiteCount; i++) {
+    const int site = current->captureSites[i];
+    if (chunk->code[site + 1] == slot) {
+      if (copied) {
+        chunk->code[site] = (uint8_t)Capture::CAPTURE_VALUE;
+      }
+      current->captureSites[i--] = current->captureSites[--current->captureSiteCount];
+    }
+  }
+  return copied;
+}
+
 static ObjFunction*
 endCompiler() {
   emitReturn();
+  for (int slot = 0; slot < current->localCount; slot++) {
+    endLocal(slot);
+  }
   ObjFunction* function = current->function;
 
 #ifdef DEBUG_PRINT_CODE
@@ -242,7 +286,8 @@ endScope() {
   current->scopeDepth -= 1;
 
   while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth) {
-    if (current->locals[current->localCount - 1].isCaptured) {
+    const bool copied = endLocal(current->localCount - 1);
+    if (current->locals[current->localCount - 1].isCaptured && !copied) {
       emitByte(OpCode::OP_CLOSE_UPVALUE);
     } else {
       emitByte(OpCode::OP_POP);
@@ -337,9 +382,60 @@ dot(bool canAssign) {
     emitByte(argCount);
   } else {
     emitBytes(OpCode::OP_GET_PROPERTY, name);
+    const uint8_t binding = currentChunk()->addBindingCache();
+    emitByte(binding);
+    current->lastBinding = binding;
+    current->lastBindingEnd = currentChunk()->getCount();
   }
 }
 
+static void
+subscript(bool canAssign) {
+  expression();
+  consume(TokenType::TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+  if (canAssign && match(TokenType::TOKEN_EQUAL)) {
+    expression();
+    emitByte(OpCode::OP_INDEX_SET);
+  } else {
+    emitByte(OpCode::OP_INDEX_GET);
+  }
+}
+
+static void
+list(bool canAssign) {
+  uint8_t itemCount = 0;
+  if (!check(TokenType::TOKEN_RIGHT_BRACKET)) {
+    do {
+      expression();
+      if (itemCount == 255) {
+        error("Can't have more than 255 items in a list literal.");
+      }
+      itemCount += 1;
+    } while (match(TokenType::TOKEN_COMMA));
+  }
+  consume(TokenType::TOKEN_RIGHT_BRACKET, "Expect ']' after list items.");
+  emitBytes(OpCode::OP_BUILD_LIST, itemCount);
+}
+
+static void
+map(bool canAssign) {
+  uint8_t entryCount = 0;
+  if (!check(TokenType::TOKEN_RIGHT_BRACE)) {
+    do {
+      expression();
+      consume(TokenType::TOKEN_COLON, "Expect ':' after map key.");
+      expression();
+      if (entryCount == 255) {
+        error("Can't have more than 255 entries in a map literal.");
+      }
+      entryCount += 1;
+    } while (match(TokenType::TOKEN_COMMA));
+  }
+  consume(TokenType::TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+  emitBytes(OpCode::OP_BUILD_MAP, entryCount);
+}
+
 static void
 literal(bool canAssign) {
   switch (parser.previous.type) {
@@ -382,22 +478,31 @@ patchJump(int offset) {
   currentChunk()->code[offset + 1] = jump & 0xff;
 }
 
+/**
+ * Start compiling a new function, or the deferred body of `function` when it is given.
+ */
 static void
-initCompiler(Compiler* compiler, FunctionType type) {
+initCompiler(Compiler* compiler, FunctionType type, ObjFunction* function = nullptr) {
   compiler->enclosing = current;
   compiler->function = nullptr;
   compiler->type = type;
   compiler->localCount = 0;
   compiler->scopeDepth = 0;
-  compiler->function = newFunction();
+  compiler->captureSiteCount = 0;
+  compiler->lastBinding = -1;
+  compiler->lastBindingEnd = -1;
+  compiler->function = function != nullptr ? function : newFunction();
   current = compiler;
-  if (type != FunctionType::TYPE_SCRIPT) {
+  if (type != FunctionType::TYPE_SCRIPT && function == nullptr) {
     current->function->name = copyString(parser.previous.start, parser.previous.length);
   }
 
   Local* local = &(current->locals[current->localCount++]);
   local->depth = 0;
   local->isCaptured = false;
+  local->isAssigned = false;
+  local->isRead = false;
+  local->binding = -1;
   if (type != FunctionType::TYPE_FUNCTION) {
     local->name.start = "this";
     local->name.length = 4;
@@ -446,6 +551,8 @@ static int
 resolveLocal(Compiler* compiler, Token* name);
 static int
 resolveUpvalue(Compiler* compiler, Token* name);
+static void
+markUpvalueAssigned(Compiler* compiler, int upvalue);
 
 static void
 namedVariable(Token name, bool canAssign) {
@@ -464,9 +571,17 @@ namedVariable(Token name, bool canAssign) {
   }
 
   if (canAssign && match(TokenType::TOKEN_EQUAL)) {
+    if (setOp == OpCode::OP_SET_LOCAL) {
+      current->locals[arg].isAssigned = true;
+    } else if (setOp == OpCode::OP_SET_UPVALUE) {
+      markUpvalueAssigned(current, arg);
+    }
     expression();
     emitBytes(setOp, (uint8_t)arg);
   } else {
+    if (getOp == OpCode::OP_GET_LOCAL && !check(TokenType::TOKEN_LEFT_PAREN)) {
+      current->locals[arg].isRead = true;
+    }
     emitBytes(getOp, (uint8_t)arg);
   }
 }
@@ -502,9 +617,15 @@ super_(bool canAssign) {
     namedVariable(syntheticToken("super"), false);
     emitBytes(OpCode::OP_SUPER_INVOKE, name);
     emitByte(argCount);
+    emitByte(currentChunk()->addSuperCache());
   } else {
     namedVariable(syntheticToken("super"), false);
     emitBytes(OpCode::OP_GET_SUPER, name);
+    const uint8_t binding = currentChunk()->addBindingCache();
+    emitByte(binding);
+    emitByte(currentChunk()->addSuperCache());
+    current->lastBinding = binding;
+    current->lastBindingEnd = currentChunk()->getCount();
   }
 }
 
@@ -540,46 +661,49 @@ unary(bool canAssign) {
 
 // clang-format off
 ParseRule rules[] = {
-  [(int)TokenType::TOKEN_LEFT_PAREN]    = {grouping, call,   Precedence::PREC_CALL},
-  [(int)TokenType::TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_LEFT_BRACE]    = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_COMMA]         = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_DOT]           = {NULL,     dot,    Precedence::PREC_CALL},
-  [(int)TokenType::TOKEN_MINUS]         = {unary,    binary, Precedence::PREC_TERM},
-  [(int)TokenType::TOKEN_PLUS]          = {NULL,     binary, Precedence::PREC_TERM},
-  [(int)TokenType::TOKEN_SEMICOLON]     = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_SLASH]         = {NULL,     binary, Precedence::PREC_FACTOR},
-  [(int)TokenType::TOKEN_STAR]          = {NULL,     binary, Precedence::PREC_FACTOR},
-  [(int)TokenType::TOKEN_BANG]          = {unary,    NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_BANG_EQUAL]    = {NULL,     binary, Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_EQUAL]         = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_EQUAL_EQUAL]   = {NULL,     binary, Precedence::PREC_EQUALITY},
-  [(int)TokenType::TOKEN_GREATER]       = {NULL,     binary, Precedence::PREC_COMPARISON},
-  [(int)TokenType::TOKEN_GREATER_EQUAL] = {NULL,     binary, Precedence::PREC_COMPARISON},
-  [(int)TokenType::TOKEN_LESS]          = {NULL,     binary, Precedence::PREC_COMPARISON},
-  [(int)TokenType::TOKEN_LESS_EQUAL]    = {NULL,     binary, Precedence::PREC_COMPARISON},
-  [(int)TokenType::TOKEN_IDENTIFIER]    = {variable, NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_STRING]        = {string,   NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_NUMBER]        = {number,   NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_AND]           = {NULL,     and_,   Precedence::PREC_AND},
-  [(int)TokenType::TOKEN_CLASS]         = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_ELSE]          = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_FALSE]         = {literal,  NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_FOR]           = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_FUN]           = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_IF]            = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_NIL]           = {literal,  NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_OR]            = {NULL,     or_,    Precedence::PREC_OR},
-  [(int)TokenType::TOKEN_PRINT]         = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_RETURN]        = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_SUPER]         = {super_,   NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_THIS]          = {this_,    NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_TRUE]          = {literal,  NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_VAR]           = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_WHILE]         = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_ERROR]         = {NULL,     NULL,   Precedence::PREC_NONE},
-  [(int)TokenType::TOKEN_EOF]           = {NULL,     NULL,   Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_LEFT_PAREN]    = {grouping, call,      Precedence::PREC_CALL},
+  [(int)TokenType::TOKEN_RIGHT_PAREN]   = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_LEFT_BRACE]    = {map,      NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_RIGHT_BRACE]   = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_LEFT_BRACKET]  = {list,     subscript, Precedence::PREC_CALL},
+  [(int)TokenType::TOKEN_RIGHT_BRACKET] = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_COLON]         = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_COMMA]         = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_DOT]           = {NULL,     dot,       Precedence::PREC_CALL},
+  [(int)TokenType::TOKEN_MINUS]         = {unary,    binary,    Precedence::PREC_TERM},
+  [(int)TokenType::TOKEN_PLUS]          = {NULL,     binary,    Precedence::PREC_TERM},
+  [(int)TokenType::TOKEN_SEMICOLON]     = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_SLASH]         = {NULL,     binary,    Precedence::PREC_FACTOR},
+  [(int)TokenType::TOKEN_STAR]          = {NULL,     binary,    Precedence::PREC_FACTOR},
+  [(int)TokenType::TOKEN_BANG]          = {unary,    NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_BANG_EQUAL]    = {NULL,     binary,    Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_EQUAL]         = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_EQUAL_EQUAL]   = {NULL,     binary,    Precedence::PREC_EQUALITY},
+  [(int)TokenType::TOKEN_GREATER]       = {NULL,     binary,    Precedence::PREC_COMPARISON},
+  [(int)TokenType::TOKEN_GREATER_EQUAL] = {NULL,     binary,    Precedence::PREC_COMPARISON},
+  [(int)TokenType::TOKEN_LESS]          = {NULL,     binary,    Precedence::PREC_COMPARISON},
+  [(int)TokenType::TOKEN_LESS_EQUAL]    = {NULL,     binary,    Precedence::PREC_COMPARISON},
+  [(int)TokenType::TOKEN_IDENTIFIER]    = {variable, NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_STRING]        = {string,   NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_NUMBER]        = {number,   NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_AND]           = {NULL,     and_,      Precedence::PREC_AND},
+  [(int)TokenType::TOKEN_CLASS]         = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_ELSE]          = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_FALSE]         = {literal,  NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_FOR]           = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_FUN]           = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_IF]            = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_NIL]           = {literal,  NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_OR]            = {NULL,     or_,       Precedence::PREC_OR},
+  [(int)TokenType::TOKEN_PRINT]         = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_RETURN]        = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_SUPER]         = {super_,   NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_THIS]          = {this_,    NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_TRUE]          = {literal,  NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_VAR]           = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_WHILE]         = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_ERROR]         = {NULL,     NULL,      Precedence::PREC_NONE},
+  [(int)TokenType::TOKEN_EOF]           = {NULL,     NULL,      Precedence::PREC_NONE},
 };
 // clang-format on
 
@@ -675,6 +799,19 @@ resolveUpvalue(Compiler* compiler, Token* name) {
   return -1;
 }
 
+/**
+ * Mark the local an upvalue of `compiler` refers to, however many functions up, as assigned.
+ */
+static void
+markUpvalueAssigned(Compiler* compiler, int upvalue) {
+  const Upvalue* captured = &(compiler->upvalues[upvalue]);
+  if (captured->isLocal) {
+    compiler->enclosing->locals[captured->index].isAssigned = true;
+  } else {
+    markUpvalueAssigned(compiler->enclosing, captured->index);
+  }
+}
+
 static void
 addLocal(Token name) {
   if (current->localCount == lims::UINT8_VAL_COUNT) {
@@ -686,6 +823,9 @@ addLocal(Token name) {
   local->name = name;
   local->depth = -1;
   local->isCaptured = false;
+  local->isAssigned = false;
+  local->isRead = false;
+  local->binding = -1;
 }
 
 static void
@@ -773,19 +913,16 @@ block() {
   consume(TokenType::TOKEN_RIGHT_BRACE, "Expect '}' after block");
 }
 
-/**
- * @nonterminal
- */
 static void
-function(FunctionType type) {
-  Compiler compiler;
-  initCompiler(&compiler, type);
+functionBody(bool countArity) {
   beginScope();
 
   consume(TokenType::TOKEN_LEFT_PAREN, "Expect '(' after function name.");
   if (!check(TokenType::TOKEN_RIGHT_PAREN)) {
     do {
-      current->function->arity += 1;
+      if (countArity) {
+        current->function->arity += 1;
+      }
       if (current->function->arity > 255) {
         errorAtCurrent("Can't have more than 255 parameters.");
       }
@@ -796,12 +933,115 @@ function(FunctionType type) {
   consume(TokenType::TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
   consume(TokenType::TOKEN_LEFT_BRACE, "Expect '{' before function body.");
   block();
+}
+
+/**
+ * A body can be deferred when it can't capture anything: it is declared at the top level of the script, and a method
+ * belongs to a class without superclass (`super` is a local of the enclosing scope).
+ */
+static bool
+canDeferBody(FunctionType type) {
+  if (!deferBodies || current->type != FunctionType::TYPE_SCRIPT || current->scopeDepth > 0) {
+    return false;
+  }
+  return type == FunctionType::TYPE_FUNCTION || (currentClass != nullptr && !currentClass->hasSuperclass);
+}
+
+/**
+ * Load the closure of a function that captures nothing. Every evaluation of the declaration would make the same
+ * closure, so one is made now and kept in place of the function constant.
+ */
+static void
+emitSharedClosure(uint8_t constant) {
+  Chunk* chunk = currentChunk();
+  ObjClosure* closure = newClosure(AS_FUNCTION(chunk->constants.values[constant]));
+  chunk->constants.values[constant] = OBJ_VAL(closure);
+  emitBytes(OpCode::OP_CONSTANT, constant);
+}
+
+/**
+ * Keep a copy of the parameter list and body of a function instead of its code; compileFunctionBody() compiles it on
+ * the first call, and only then are errors in the body reported. Up front only the parameters are counted, and the
+ * tokens up to the matching '}' skipped.
+ */
+static void
+deferredFunction(FunctionType type) {
+  ObjFunction* function = newFunction();
+  uint8_t constant = makeConstant(OBJ_VAL(function));
+  function->name = copyString(parser.previous.start, parser.previous.length);
+  function->bodyLine = parser.current.line;
+  function->bodyIsMethod = type != FunctionType::TYPE_FUNCTION;
+  const char* start = parser.current.start;
+
+  consume(TokenType::TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+  if (!check(TokenType::TOKEN_RIGHT_PAREN)) {
+    do {
+      function->arity += 1;
+      if (function->arity > 255) {
+        errorAtCurrent("Can't have more than 255 parameters.");
+      }
+      consume(TokenType::TOKEN_IDENTIFIER, "Expect parameter name.");
+    } while (match(TokenType::TOKEN_COMMA));
+  }
+  consume(TokenType::TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+  consume(TokenType::TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+
+  int depth = 1;
+  while (depth > 0 && !check(TokenType::TOKEN_EOF)) {
+    if (check(TokenType::TOKEN_LEFT_BRACE)) {
+      depth += 1;
+    } else if (check(TokenType::TOKEN_RIGHT_BRACE)) {
+      depth -= 1;
+    }
+    advance();
+  }
+  if (depth > 0) {
+    errorAtCurrent("Expect '}' after block");
+  }
+
+  const int length = (int)(parser.previous.start + parser.previous.length - start);
+  char* body = ALLOCATE(char, length + 1);
+  memcpy(body, start, length);
+  body[length] = '\0';
+  function->bodySource = body;
+  function->bodyLength = length;
+
+  emitSharedClosure(constant);
+}
+
+/**
+ * @nonterminal
+ */
+static void
+function(FunctionType type) {
+  if (canDeferBody(type)) {
+    deferredFunction(type);
+    return;
+  }
+
+  Compiler compiler;
+  initCompiler(&compiler, type);
+  functionBody(true);
 
   ObjFunction* function = endCompiler();
-  emitBytes(OpCode::OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+  const uint8_t constant = makeConstant(OBJ_VAL(function));
+  if (function->upvalueCount == 0) {
+    emitSharedClosure(constant);
+    return;
+  }
 
+  emitBytes(OpCode::OP_CLOSURE, constant);
   for (int i = 0; i < function->upvalueCount; i++) {
-    emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
+    if (!compiler.upvalues[i].isLocal) {
+      emitByte((uint8_t)Capture::CAPTURE_UPVALUE);
+    } else if (current->captureSiteCount < lims::UINT8_VAL_COUNT) {
+      current->captureSites[current->captureSiteCount++] = currentChunk()->getCount();
+      emitByte((uint8_t)Capture::CAPTURE_LOCAL);
+    } else {
+      // NOTE: no room to remember the site, so the local has to stay shared
+      current->locals[compiler.upvalues[i].index].isAssigned = true;
+      emitByte((uint8_t)Capture::CAPTURE_LOCAL);
+    }
     emitByte(compiler.upvalues[i].index);
   }
 }
@@ -883,6 +1123,12 @@ varDeclaration() {
 
   if (match(TokenType::TOKEN_EQUAL)) {
     expression();
+    // A local initialized by a method read holds the bound method in the slot the read left it in.
+    // NOTE: the last slot of Chunk::bindings may be shared by several sites
+    if (current->scopeDepth > 0 && current->lastBindingEnd == currentChunk()->getCount() &&
+        current->lastBinding < lims::UINT8_VAL_COUNT - 1) {
+      current->locals[current->localCount - 1].binding = current->lastBinding;
+    }
   } else {
     emitByte(OpCode::OP_NIL);
   }
@@ -1026,6 +1272,8 @@ synchronize() {
       return;
     default:; // Do nothing.
     }
+
+    advance();
   }
 }
 
@@ -1070,9 +1318,8 @@ statement() {
   }
 }
 
-ObjFunction*
-compile(const char* source) {
-  initScanner(source);
+static ObjFunction*
+compileScript() {
   Compiler compiler;
   initCompiler(&compiler, FunctionType::TYPE_SCRIPT);
 
@@ -1089,6 +1336,65 @@ compile(const char* source) {
   return parser.hadError ? nullptr : function;
 }
 
+ObjFunction*
+compile(const char* source) {
+  initScanner(source);
+  deferBodies = false;
+  return compileScript();
+}
+
+ObjFunction*
+compile(Source* source) {
+  initScanner(source);
+  deferBodies = true;
+  return compileScript();
+}
+
+bool
+compileFunctionBody(ObjFunction* function) {
+  initScanner(function->bodySource, function->bodyLine);
+  deferBodies = false;
+  parser.hadError = false;
+  parser.panicMode = false;
+
+  // Start over if an earlier attempt failed half-way.
+  function->chunk.code.count = 0;
+  function->chunk.lines.count = 0;
+  function->chunk.constants.values.count = 0;
+  function->chunk.bindings.count = 0;
+  function->chunk.superCaches.count = 0;
+
+  FunctionType type = FunctionType::TYPE_FUNCTION;
+  ClassCompiler classCompiler;
+  classCompiler.enclosing = nullptr;
+  classCompiler.hasSuperclass = false;
+  if (function->bodyIsMethod) {
+    type = function->name == vm.initString ? FunctionType::TYPE_INITIALIZER : FunctionType::TYPE_METHOD;
+    currentClass = &classCompiler;
+  }
+
+  Compiler compiler;
+  initCompiler(&compiler, type, function);
+  advance();
+  functionBody(false);
+  endCompiler();
+  currentClass = nullptr;
+
+  if (parser.hadError) {
+    return false;
+  }
+  FREE_ARRAY(char, function->bodySource, function->bodyLength + 1);
+  function->bodySource = nullptr;
+  return true;
+}
+
+void
+abortCompilation() {
+  current = nullptr;
+  currentClass = nullptr;
+  deferBodies = false;
+}
+
 void
 markCompilerRoots() {
   Compiler* compiler = current;
@@ -2,11 +2,27 @@
 #define CLOX_COMPILER_H
 
 #include "object.h"
+#include "source.h"
 #include "vm.h"
 
 ObjFunction*
 compile(const char* source);
 
+ObjFunction*
+compile(Source* source);
+
+/**
+ * Compile a body that compile() deferred, the first time its function is called.
+ */
+bool
+compileFunctionBody(ObjFunction* function);
+
+/**
+ * Forget the compilers of a compilation that an OutOfMemory cut short.
+ */
+void
+abortCompilation();
+
 void
 markCompilerRoots();
 
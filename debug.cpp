@@ -22,6 +22,16 @@ constantInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 2;
 }
 
+static int
+bindingInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t cache = chunk->code[offset + 2];
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' cache %d\n", cache);
+  return offset + 3;
+}
+
 static int
 invokeInstruction(const char* name, Chunk* chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
@@ -32,6 +42,28 @@ invokeInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 3;
 }
 
+static int
+superInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t cache = chunk->code[offset + 2];
+  uint8_t superCache = chunk->code[offset + 3];
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' cache %d super %d\n", cache, superCache);
+  return offset + 4;
+}
+
+static int
+superInvokeInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t argCount = chunk->code[offset + 2];
+  uint8_t superCache = chunk->code[offset + 3];
+  printf("%-16s (%d args) %4d '", name, argCount, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' super %d\n", superCache);
+  return offset + 4;
+}
+
 static int
 simpleInstruction(const char* name, int offset) {
   printf("%s\n", name);
@@ -57,10 +89,11 @@ int
 disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
 
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+  const int line = chunk->getLine(offset);
+  if (offset > 0 && line == chunk->getLine(offset - 1)) {
     printf("   | ");
   } else {
-    printf("%4d ", chunk->lines[offset]);
+    printf("%4d ", line);
   }
 
   uint8_t byte = chunk->code[offset];
@@ -91,11 +124,11 @@ disassembleInstruction(Chunk* chunk, int offset) {
   case OpCode::OP_SET_UPVALUE:
     return byteInstruction("OP_SET_UPVALUE", chunk, offset);
   case OpCode::OP_GET_PROPERTY:
-    return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+    return bindingInstruction("OP_GET_PROPERTY", chunk, offset);
   case OpCode::OP_SET_PROPERTY:
     return constantInstruction("OP_SET_PROPERTY", chunk, offset);
   case OpCode::OP_GET_SUPER:
-    return constantInstruction("OP_GET_SUPER", chunk, offset);
+    return superInstruction("OP_GET_SUPER", chunk, offset);
   case OpCode::OP_EQUAL:
     return simpleInstruction("OP_EQUAL", offset);
   case OpCode::OP_GREATER:
@@ -122,10 +155,20 @@ disassembleInstruction(Chunk* chunk, int offset) {
     return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
   case OpCode::OP_LOOP:
     return jumpInstruction("OP_LOOP", -1, chunk, offset);
+  case OpCode::OP_BUILD_LIST:
+    return byteInstruction("OP_BUILD_LIST", chunk, offset);
+  case OpCode::OP_BUILD_MAP:
+    return byteInstruction("OP_BUILD_MAP", chunk, offset);
+  case OpCode::OP_INDEX_GET:
+    return simpleInstruction("OP_INDEX_GET", offset);
+  case OpCode::OP_INDEX_SET:
+    return simpleInstruction("OP_INDEX_SET", offset);
   case OpCode::OP_CALL:
     return byteInstruction("OP_CALL", chunk, offset);
   case OpCode::OP_INVOKE:
     return invokeInstruction("OP_INVOKE", chunk, offset);
+  case OpCode::OP_SUPER_INVOKE:
+    return superInvokeInstruction("OP_SUPER_INVOKE", chunk, offset);
   case OpCode::OP_CLOSURE: {
     offset++;
     uint8_t constant = chunk->code[offset++];
@@ -135,9 +178,11 @@ disassembleInstruction(Chunk* chunk, int offset) {
 
     ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
     for (int j = 0; j < function->upvalueCount; j++) {
-      int isLocal = chunk->code[offset++];
+      const Capture capture = static_cast<Capture>(chunk->code[offset++]);
       int index = chunk->code[offset++];
-      printf("%04d      |                     %s %d\n", offset - 2, isLocal ? "local" : "upvalue", index);
+      const char* kind = capture == Capture::CAPTURE_UPVALUE ? "upvalue"
+                                                             : (capture == Capture::CAPTURE_LOCAL ? "local" : "value");
+      printf("%04d      |                     %s %d\n", offset - 2, kind, index);
     }
 
     return offset;
@@ -157,3 +202,92 @@ disassembleInstruction(Chunk* chunk, int offset) {
     return offset + 1;
   }
 }
+
+const char*
+opCodeName(OpCode code) {
+  switch (code) {
+  case OpCode::OP_CONSTANT:
+    return "OP_CONSTANT";
+  case OpCode::OP_NIL:
+    return "OP_NIL";
+  case OpCode::OP_TRUE:
+    return "OP_TRUE";
+  case OpCode::OP_FALSE:
+    return "OP_FALSE";
+  case OpCode::OP_POP:
+    return "OP_POP";
+  case OpCode::OP_GET_LOCAL:
+    return "OP_GET_LOCAL";
+  case OpCode::OP_SET_LOCAL:
+    return "OP_SET_LOCAL";
+  case OpCode::OP_GET_GLOBAL:
+    return "OP_GET_GLOBAL";
+  case OpCode::OP_DEFINE_GLOBAL:
+    return "OP_DEFINE_GLOBAL";
+  case OpCode::OP_SET_GLOBAL:
+    return "OP_SET_GLOBAL";
+  case OpCode::OP_GET_UPVALUE:
+    return "OP_GET_UPVALUE";
+  case OpCode::OP_SET_UPVALUE:
+    return "OP_SET_UPVALUE";
+  case OpCode::OP_GET_PROPERTY:
+    return "OP_GET_PROPERTY";
+  case OpCode::OP_SET_PROPERTY:
+    return "OP_SET_PROPERTY";
+  case OpCode::OP_GET_SUPER:
+    return "OP_GET_SUPER";
+  case OpCode::OP_EQUAL:
+    return "OP_EQUAL";
+  case OpCode::OP_GREATER:
+    return "OP_GREATER";
+  case OpCode::OP_LESS:
+    return "OP_LESS";
+  case OpCode::OP_ADD:
+    return "OP_ADD";
+  case OpCode::OP_SUBTRACT:
+    return "OP_SUBTRACT";
+  case OpCode::OP_MULTIPLY:
+    return "OP_MULTIPLY";
+  case OpCode::OP_DIVIDE:
+    return "OP_DIVIDE";
+  case OpCode::OP_NOT:
+    return "OP_NOT";
+  case OpCode::OP_NEGATE:
+    return "OP_NEGATE";
+  case OpCode::OP_PRINT:
+    return "OP_PRINT";
+  case OpCode::OP_JUMP:
+    return "OP_JUMP";
+  case OpCode::OP_JUMP_IF_FALSE:
+    return "OP_JUMP_IF_FALSE";
+  case OpCode::OP_LOOP:
+    return "OP_LOOP";
+  case OpCode::OP_BUILD_LIST:
+    return "OP_BUILD_LIST";
+  case OpCode::OP_BUILD_MAP:
+    return "OP_BUILD_MAP";
+  case OpCode::OP_INDEX_GET:
+    return "OP_INDEX_GET";
+  case OpCode::OP_INDEX_SET:
+    return "OP_INDEX_SET";
+  case OpCode::OP_CALL:
+    return "OP_CALL";
+  case OpCode::OP_INVOKE:
+    return "OP_INVOKE";
+  case OpCode::OP_SUPER_INVOKE:
+    return "OP_SUPER_INVOKE";
+  case OpCode::OP_CLOSURE:
+    return "OP_CLOSURE";
+  case OpCode::OP_CLOSE_UPVALUE:
+    return "OP_CLOSE_UPVALUE";
+  case OpCode::OP_RETURN:
+    return "OP_RETURN";
+  case OpCode::OP_CLASS:
+    return "OP_CLASS";
+  case OpCode::OP_INHERIT:
+    return "OP_INHERIT";
+  case OpCode::OP_METHOD:
+    return "OP_METHOD";
+  }
+  return "OP_UNKNOWN";
+}
@@ -9,4 +9,7 @@ disassembleChunk(Chunk* chunk, const char* name);
 int
 disassembleInstruction(Chunk* chunk, int offset);
 
+const char*
+opCodeName(OpCode code);
+
 #endif
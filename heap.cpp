@@ -0,0 +1,316 @@
+#include "heap.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static int
+sizeClassOf(size_t size) {
+  return (int)((size + HEAP_SLOT_ALIGN - 1) / HEAP_SLOT_ALIGN) - 1;
+}
+
+static Obj*
+slotAt(HeapPage* page, int slot) {
+  return (Obj*)((char*)page + HEAP_PAGE_HEADER + (size_t)slot * page->slotSize);
+}
+
+static HeapPage*
+newPage(Heap* heap, int sizeClass) {
+  void* memory = nullptr;
+#ifdef _WIN32
+  memory = _aligned_malloc(HEAP_PAGE_SIZE, HEAP_PAGE_SIZE);
+#else
+  if (posix_memalign(&memory, HEAP_PAGE_SIZE, HEAP_PAGE_SIZE) != 0) {
+    memory = nullptr;
+  }
+#endif
+  if (memory == nullptr) {
+    return nullptr;
+  }
+
+  HeapPage* page = (HeapPage*)memory;
+  memset(page, 0, sizeof(HeapPage));
+  page->slotSize = (uint32_t)((sizeClass + 1) * HEAP_SLOT_ALIGN);
+  page->slotReciprocal = (uint32_t)(((uint64_t{1} << 32) + page->slotSize - 1) / page->slotSize);
+  page->sizeClass = sizeClass;
+  page->slotCount = (int)((HEAP_PAGE_SIZE - HEAP_PAGE_HEADER) / page->slotSize);
+
+  // Link the slots back to front, so the first allocation takes the lowest address.
+  for (int slot = page->slotCount - 1; slot >= 0; slot--) {
+    void* free = slotAt(page, slot);
+    *(void**)free = page->freeList;
+    page->freeList = free;
+  }
+
+  page->next = heap->pages[sizeClass];
+  heap->pages[sizeClass] = page;
+  page->nextAvailable = heap->available[sizeClass];
+  heap->available[sizeClass] = page;
+  heap->pageCount += 1;
+  return page;
+}
+
+static void
+releasePage(Heap* heap, HeapPage* page) {
+  heap->pageCount -= 1;
+#ifdef _WIN32
+  _aligned_free(page);
+#else
+  free(page);
+#endif
+}
+
+void
+initHeap(Heap* heap) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    heap->pages[i] = nullptr;
+    heap->unswept[i] = nullptr;
+    heap->available[i] = nullptr;
+  }
+  heap->pageCount = 0;
+  heap->unsweptCount = 0;
+  heap->sweepClass = 0;
+}
+
+void
+freeHeap(Heap* heap) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    HeapPage* lists[] = {heap->pages[i], heap->unswept[i]};
+    for (HeapPage* list : lists) {
+      while (list != nullptr) {
+        HeapPage* next = list->next;
+        releasePage(heap, list);
+        list = next;
+      }
+    }
+  }
+  initHeap(heap);
+}
+
+static void
+sweepPage(Heap* heap, HeapPage* page, ObjectVisitor freeDead, void* context) {
+  for (int word = 0; word < HEAP_BITMAP_WORDS; word++) {
+    uint64_t dead = page->allocated[word] & ~page->marks[word];
+    while (dead != 0) {
+      const int bit = lowestBit(dead);
+      dead &= dead - 1;
+      freeDead(slotAt(page, word * 64 + bit), context);
+    }
+    page->marks[word] = 0;
+  }
+
+  if (page->liveCount == 0) {
+    releasePage(heap, page);
+    return;
+  }
+  page->next = heap->pages[page->sizeClass];
+  heap->pages[page->sizeClass] = page;
+  if (page->freeList != nullptr) {
+    page->nextAvailable = heap->available[page->sizeClass];
+    heap->available[page->sizeClass] = page;
+  }
+}
+
+static void
+sweepNextPage(Heap* heap, int sizeClass, ObjectVisitor freeDead, void* context) {
+  HeapPage* page = heap->unswept[sizeClass];
+  heap->unswept[sizeClass] = page->next;
+  heap->unsweptCount -= 1;
+  sweepPage(heap, page, freeDead, context);
+}
+
+void*
+heapAllocate(Heap* heap, size_t size, ObjectVisitor freeDead, void* context) {
+  const int sizeClass = sizeClassOf(size);
+  for (;;) {
+    HeapPage* page = heap->available[sizeClass];
+    if (page == nullptr) {
+      if (heap->unswept[sizeClass] != nullptr) {
+        sweepNextPage(heap, sizeClass, freeDead, context);
+        continue;
+      }
+      page = newPage(heap, sizeClass);
+      if (page == nullptr) {
+        return nullptr;
+      }
+    }
+    if (page->freeList == nullptr) {
+      heap->available[sizeClass] = page->nextAvailable;
+      continue;
+    }
+
+    void* object = page->freeList;
+    page->freeList = *(void**)object;
+    const int slot = slotOf(page, object);
+    page->allocated[slot >> 6] |= uint64_t{1} << (slot & 63);
+    page->liveCount += 1;
+    return object;
+  }
+}
+
+void
+heapRelease(void* object) {
+  HeapPage* page = pageOf(object);
+  const int slot = slotOf(page, object);
+  page->allocated[slot >> 6] &= ~(uint64_t{1} << (slot & 63));
+  page->liveCount -= 1;
+  *(void**)object = page->freeList;
+  page->freeList = object;
+}
+
+void
+heapStartSweep(Heap* heap) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    // NOTE: a collection finishes the last sweep before it marks, so unswept[i] is empty here
+    heap->unswept[i] = heap->pages[i];
+    heap->pages[i] = nullptr;
+    heap->available[i] = nullptr;
+  }
+  heap->unsweptCount = heap->pageCount;
+  heap->sweepClass = 0;
+}
+
+void
+sweepHeapPages(Heap* heap, int count, ObjectVisitor freeDead, void* context) {
+  while (count > 0 && heap->unsweptCount > 0) {
+    if (heap->unswept[heap->sweepClass] == nullptr) {
+      heap->sweepClass = (heap->sweepClass + 1) % HEAP_SIZE_CLASSES;
+      continue;
+    }
+    sweepNextPage(heap, heap->sweepClass, freeDead, context);
+    count--;
+  }
+}
+
+static void
+eachOnPage(HeapPage* page, ObjectVisitor visitor, void* context) {
+  for (int word = 0; word < HEAP_BITMAP_WORDS; word++) {
+    // NOTE: a copy of the word, the visitor may free the object it is given
+    uint64_t allocated = page->allocated[word];
+    while (allocated != 0) {
+      const int bit = lowestBit(allocated);
+      allocated &= allocated - 1;
+      visitor(slotAt(page, word * 64 + bit), context);
+    }
+  }
+}
+
+void
+heapEach(Heap* heap, ObjectVisitor visitor, void* context) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    HeapPage* lists[] = {heap->pages[i], heap->unswept[i]};
+    for (HeapPage* list : lists) {
+      heapEachOnPages(list, visitor, context);
+    }
+  }
+}
+
+void
+heapEachOnPages(HeapPage* pages, ObjectVisitor visitor, void* context) {
+  for (HeapPage* page = pages; page != nullptr; page = page->next) {
+    eachOnPage(page, visitor, context);
+  }
+}
+
+/**
+ * Pages of `sizeClass` its live objects can do without; `pageCount` gets how many it has.
+ */
+static int
+surplusPages(const Heap* heap, int sizeClass, int* pageCount) {
+  int pages = 0;
+  size_t live = 0;
+  int slotCount = 0;
+  for (const HeapPage* page = heap->pages[sizeClass]; page != nullptr; page = page->next) {
+    pages += 1;
+    live += (size_t)page->liveCount;
+    slotCount = page->slotCount;
+  }
+  *pageCount = pages;
+  if (pages == 0) {
+    return 0;
+  }
+  return pages - (int)((live + slotCount - 1) / slotCount);
+}
+
+int
+heapReclaimablePages(const Heap* heap) {
+  int reclaimable = 0;
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    int pageCount;
+    reclaimable += surplusPages(heap, i, &pageCount);
+  }
+  return reclaimable;
+}
+
+static int
+compareLiveCounts(const void* a, const void* b) {
+  return (*(HeapPage* const*)a)->liveCount - (*(HeapPage* const*)b)->liveCount;
+}
+
+HeapPage*
+heapTakeSparsePages(Heap* heap) {
+  HeapPage* taken = nullptr;
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    int pageCount;
+    const int surplus = surplusPages(heap, i, &pageCount);
+    if (surplus <= 0) {
+      continue;
+    }
+
+    // NOTE: malloc, not reallocate(): this runs in the middle of a compaction
+    HeapPage** order = (HeapPage**)malloc(sizeof(HeapPage*) * pageCount);
+    if (order == nullptr) {
+      continue;
+    }
+    int count = 0;
+    for (HeapPage* page = heap->pages[i]; page != nullptr; page = page->next) {
+      order[count++] = page;
+    }
+    qsort(order, count, sizeof(HeapPage*), compareLiveCounts);
+
+    for (int taking = 0; taking < surplus && order[taking]->liveCount <= order[taking]->slotCount / 2; taking++) {
+      order[taking]->evacuating = true;
+    }
+
+    // Relink the rest densest first, so evacuated objects fill up the fullest pages.
+    heap->pages[i] = nullptr;
+    heap->available[i] = nullptr;
+    for (int j = 0; j < count; j++) {
+      HeapPage* page = order[j];
+      if (page->evacuating) {
+        page->next = taken;
+        taken = page;
+        continue;
+      }
+      page->next = heap->pages[i];
+      heap->pages[i] = page;
+      if (page->freeList != nullptr) {
+        page->nextAvailable = heap->available[i];
+        heap->available[i] = page;
+      }
+    }
+    free(order);
+  }
+  return taken;
+}
+
+Obj*
+heapEvacuate(Heap* heap, Obj* object) {
+  const HeapPage* from = pageOf(object);
+  Obj* copy = (Obj*)heapAllocate(heap, from->slotSize, nullptr, nullptr);
+  memcpy((void*)copy, (const void*)object, from->slotSize);
+  *(Obj**)object = copy;
+  return copy;
+}
+
+void
+heapReleasePages(Heap* heap, HeapPage* pages) {
+  while (pages != nullptr) {
+    HeapPage* next = pages->next;
+    releasePage(heap, pages);
+    pages = next;
+  }
+}
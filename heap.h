@@ -0,0 +1,190 @@
+#ifndef CLOX_HEAP_H
+#define CLOX_HEAP_H
+
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// The object heap. Objects live in pages of HEAP_PAGE_SIZE bytes, aligned to their size, and each page holds slots of
+// a single size class. The metadata of a slot lives in its page's header, not in the object: the allocation bitmap,
+// which tells where objects start, and the mark bitmap of the collector. The collector finds the page of an object by
+// masking its address, and sweeps a page by scanning its bitmaps.
+//
+// Only the Obj structs live here; the arrays they own are still allocated with reallocate().
+//
+// Objects do not move, except when the collector compacts: it evacuates the sparsest pages into the free slots of the
+// others, leaving each moved object's new address in its old slot until every reference has been updated.
+
+class Obj;
+
+constexpr size_t HEAP_PAGE_SIZE = 64 * 1024;
+constexpr size_t HEAP_SLOT_ALIGN = 16;
+constexpr size_t HEAP_SLOT_MAX = 256; // the largest Obj struct must fit
+constexpr int HEAP_SIZE_CLASSES = (int)(HEAP_SLOT_MAX / HEAP_SLOT_ALIGN);
+constexpr int HEAP_BITMAP_WORDS = (int)(HEAP_PAGE_SIZE / HEAP_SLOT_ALIGN / 64);
+
+struct HeapPage {
+  HeapPage* next;          // in Heap::pages or Heap::unswept
+  HeapPage* nextAvailable; // in Heap::available
+  uint32_t slotSize;
+  uint32_t slotReciprocal; // ceil(2^32 / slotSize), to find a slot without dividing
+  int sizeClass;
+  int slotCount;
+  int liveCount;
+  bool evacuating; // taken out of the heap by heapTakeSparsePages()
+  void* freeList;  // free slots, linked through their first word
+  uint64_t allocated[HEAP_BITMAP_WORDS];
+  uint64_t marks[HEAP_BITMAP_WORDS];
+};
+
+constexpr size_t HEAP_PAGE_HEADER = (sizeof(HeapPage) + HEAP_SLOT_ALIGN - 1) / HEAP_SLOT_ALIGN * HEAP_SLOT_ALIGN;
+
+/**
+ * Per size class: `pages` have been swept since the last collection, or were added after it; `unswept` have not; the
+ * swept pages that have free slots are also on `available`, where allocation looks first.
+ */
+struct Heap {
+  HeapPage* pages[HEAP_SIZE_CLASSES];
+  HeapPage* unswept[HEAP_SIZE_CLASSES];
+  HeapPage* available[HEAP_SIZE_CLASSES];
+  int pageCount;
+  int unsweptCount;
+  int sweepClass; // where sweepHeapPages() goes on
+};
+
+typedef void (*ObjectVisitor)(Obj* object, void* context);
+
+void
+initHeap(Heap* heap);
+
+/**
+ * Release every page; the objects in them must have been freed.
+ */
+void
+freeHeap(Heap* heap);
+
+/**
+ * A slot for an object of `size` bytes, or nullptr when no page could be allocated. Sweeps pages of the size class
+ * that are still unswept before it takes a new one, calling `freeDead` for their dead objects.
+ */
+void*
+heapAllocate(Heap* heap, size_t size, ObjectVisitor freeDead, void* context);
+
+/**
+ * Return the slot of an object that has been freed.
+ */
+void
+heapRelease(void* object);
+
+/**
+ * Move every page to the unswept lists; the marks are then what the next sweep goes by.
+ */
+void
+heapStartSweep(Heap* heap);
+
+/**
+ * Sweep up to `count` unswept pages: call `freeDead` for each allocated object that is not marked, and clear the marks.
+ */
+void
+sweepHeapPages(Heap* heap, int count, ObjectVisitor freeDead, void* context);
+
+/**
+ * Call `visitor` for every allocated object, swept or not.
+ */
+void
+heapEach(Heap* heap, ObjectVisitor visitor, void* context);
+
+/**
+ * Pages that compaction could give back: per size class, the pages beyond those the live objects would fill. Everything
+ * must be swept.
+ */
+int
+heapReclaimablePages(const Heap* heap);
+
+/**
+ * Take the sparsest pages of each size class out of the heap, as many as its live objects can do without and none more
+ * than half full, and flag them as evacuating. Returns them linked through `next`. Everything must be swept.
+ */
+HeapPage*
+heapTakeSparsePages(Heap* heap);
+
+/**
+ * Copy an object of an evacuating page into a free slot of a page that stays and leave the new address in the old slot.
+ * The pages that stay have room for everything heapTakeSparsePages() took, so this does not allocate pages.
+ */
+Obj*
+heapEvacuate(Heap* heap, Obj* object);
+
+/**
+ * Call `visitor` for every allocated object on a list of pages linked through `next`.
+ */
+void
+heapEachOnPages(HeapPage* pages, ObjectVisitor visitor, void* context);
+
+/**
+ * Release pages taken by heapTakeSparsePages() once their objects have been evacuated.
+ */
+void
+heapReleasePages(Heap* heap, HeapPage* pages);
+
+inline HeapPage*
+pageOf(const void* object) {
+  return (HeapPage*)((uintptr_t)object & ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+}
+
+inline int
+slotOf(const HeapPage* page, const void* object) {
+  const uint64_t offset = (uintptr_t)object - (uintptr_t)page - HEAP_PAGE_HEADER;
+  return (int)((offset * page->slotReciprocal) >> 32);
+}
+
+/**
+ * Where `object` is now: its new address if it was evacuated, else itself.
+ */
+inline Obj*
+forwardedObject(Obj* object) {
+  return pageOf(object)->evacuating ? *(Obj**)object : object;
+}
+
+inline bool
+isMarked(const Obj* object) {
+  const HeapPage* page = pageOf(object);
+  const int slot = slotOf(page, object);
+  return (page->marks[slot >> 6] >> (slot & 63)) & 1;
+}
+
+/**
+ * Set the mark bit of `object`; false if it was set already.
+ */
+inline bool
+setMarked(Obj* object) {
+  HeapPage* page = pageOf(object);
+  const int slot = slotOf(page, object);
+  uint64_t* word = &(page->marks[slot >> 6]);
+  const uint64_t bit = uint64_t{1} << (slot & 63);
+  if (*word & bit) {
+    return false;
+  }
+  *word |= bit;
+  return true;
+}
+
+#ifdef __GNUC__
+/**
+ * setMarked() for several markers at once: exactly one of them sees true.
+ */
+inline bool
+setMarkedAtomic(Obj* object) {
+  HeapPage* page = pageOf(object);
+  const int slot = slotOf(page, object);
+  uint64_t* word = &(page->marks[slot >> 6]);
+  const uint64_t bit = uint64_t{1} << (slot & 63);
+  if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) {
+    return false;
+  }
+  return !(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit);
+}
+#endif
+
+#endif
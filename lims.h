@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 namespace lims {
 
 constexpr int CONSTANT_INDEX_MAX = 255;
@@ -7,4 +9,19 @@ constexpr int UINT8_VAL_COUNT = 256; // locals' count, upvalues' count
 constexpr int FRAMES_MAX = 64;
 constexpr int STACK_MAX = FRAMES_MAX * UINT8_VAL_COUNT;
 
+constexpr int FLOAT64_ARRAY_MAX = 1 << 28; // elements, 2 GiB
+constexpr int PRINT_DEPTH_MAX = 64;         // lists and maps nested deeper print as a placeholder
+constexpr int ROPE_MIN_LENGTH = 64;         // shorter concatenations of flat strings are copied instead of a rope
+
+constexpr int GC_MARKERS_MAX = 16;                         // threads that mark in parallel
+constexpr size_t GC_PARALLEL_MARK_MIN = 4 * 1024 * 1024; // smaller heaps are marked on the mutator thread
+constexpr int GC_SWEEP_SLICE = 64;                       // pages swept by each allocation that grows the heap
+constexpr int GC_COMPACT_MIN_PAGES = 16;                  // smaller heaps are never compacted
+constexpr int GC_COMPACT_INTERVAL = 4;                    // collections between two compactions, at least
+
+constexpr int SAMPLE_INTERVAL_MICROS = 1000; // CPU time between two samples of the sampling profiler
+
+constexpr size_t SOURCE_STREAM_RESERVE = size_t{1} << 30; // address space reserved for a streamed source
+constexpr size_t SOURCE_STREAM_BLOCK = 64 * 1024;         // bytes requested from the stream per refill
+
 }
@@ -1,10 +1,14 @@
 // #include "common.h"
 // #include "chunk.h"
 // #include "debug.h"
+#include "lims.h"
+#include "sampler.h"
+#include "source.h"
 #include "vm.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 static void
 repl() {
@@ -21,63 +25,126 @@ repl() {
   }
 }
 
-static char*
-readFile(const char* path) {
-  FILE* file = fopen(path, "rb");
-  if (file == nullptr) {
-    fprintf(stderr, "Could not open file \"%s\".\n", path);
-    exit(74);
+static void
+runSource(Source* source) {
+  InterpretResult result = interpret(source);
+  closeSource(source);
+  if (result != InterpretResult::INTERPRET_OK) {
+    stopSampling();
   }
 
-  fseek(file, 0L, SEEK_END);
-  size_t fileSize = ftell(file);
-  rewind(file);
+  if (result == InterpretResult::INTERPRET_COMPILE_ERROR) {
+    exit(65);
+  }
+  if (result == InterpretResult::INTERPRET_RUNTIME_ERROR) {
+    exit(70);
+  }
+}
 
-  char* buffer = (char*)malloc(fileSize + 1);
-  if (buffer == nullptr) {
-    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+static void
+runFile(const char* path) {
+  Source source;
+  if (!openSourceFile(&source, path)) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
     exit(74);
   }
+  runSource(&source);
+}
 
-  size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-  if (bytesRead < fileSize) {
-    fprintf(stderr, "Could not read file \"%s\".\n", path);
+/**
+ * Compile stdin while it is still being read, e.g. `generate-script | clox -`.
+ */
+static void
+runStdin() {
+  Source source;
+  if (!openSourceStream(&source, stdin)) {
+    fprintf(stderr, "Could not read standard input.\n");
     exit(74);
   }
-
-  buffer[bytesRead] = '\0';
-
-  fclose(file);
-  return buffer;
+  runSource(&source);
 }
 
 static void
-runFile(const char* path) {
-  char* source = readFile(path);
-  InterpretResult result = interpret(source);
-  free(source);
+usage() {
+  fprintf(stderr, "Usage: clox [--sample folded-stacks-file] [--gc-initial size] [--gc-grow-factor factor]\n"
+                  "            [--gc-min-heap size] [--gc-max-heap size] [--heap-limit size]\n"
+                  "            [--gc-mark-threads count] [--gc-compact-at share] [path | -]\n");
+  exit(64);
+}
 
-  if (result == InterpretResult::INTERPRET_COMPILE_ERROR) {
-    exit(65);
+/**
+ * Parse a GC tuning option into `config`; false if `option` is not one.
+ */
+static bool
+parseGCOption(const char* option, const char* value, GCConfig* config) {
+  bool valid;
+  if (strcmp(option, "--gc-initial") == 0) {
+    valid = parseByteSize(value, &(config->initialThreshold));
+  } else if (strcmp(option, "--gc-grow-factor") == 0) {
+    valid = parseGrowFactor(value, &(config->growFactor));
+  } else if (strcmp(option, "--gc-min-heap") == 0) {
+    valid = parseByteSize(value, &(config->minThreshold));
+  } else if (strcmp(option, "--gc-max-heap") == 0) {
+    valid = parseByteSize(value, &(config->maxThreshold));
+  } else if (strcmp(option, "--heap-limit") == 0) {
+    valid = parseByteSize(value, &(config->heapLimit));
+  } else if (strcmp(option, "--gc-mark-threads") == 0) {
+    valid = parseMarkThreads(value, &(config->markThreads));
+  } else if (strcmp(option, "--gc-compact-at") == 0) {
+    valid = parseHeapShare(value, &(config->compactAt));
+  } else {
+    return false;
   }
-  if (result == InterpretResult::INTERPRET_RUNTIME_ERROR) {
-    exit(70);
+
+  if (!valid) {
+    fprintf(stderr, "Invalid value \"%s\" for %s.\n", value, option);
+    exit(64);
   }
+  return true;
 }
 
 int
 main(int argc, const char* argv[]) {
-  initVM();
+  GCConfig gcConfig = defaultGCConfig();
+  const char* badVariable = gcConfigFromEnv(&gcConfig);
+  if (badVariable != nullptr) {
+    fprintf(stderr, "Invalid value \"%s\" for %s.\n", getenv(badVariable), badVariable);
+    exit(64);
+  }
 
-  if (argc == 1) {
+  const char* samplePath = nullptr;
+  int arg = 1;
+  while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+    if (arg + 1 >= argc) {
+      usage();
+    }
+    if (strcmp(argv[arg], "--sample") == 0) {
+      samplePath = argv[arg + 1];
+    } else if (!parseGCOption(argv[arg], argv[arg + 1], &gcConfig)) {
+      usage();
+    }
+    arg += 2;
+  }
+  if (argc - arg > 1) {
+    usage();
+  }
+
+  initVM(&gcConfig);
+
+  if (samplePath != nullptr && !startSampling(samplePath, lims::SAMPLE_INTERVAL_MICROS)) {
+    fprintf(stderr, "Could not start the sampling profiler.\n");
+    exit(74);
+  }
+
+  if (arg == argc) {
     repl();
-  } else if (argc == 2) {
-    runFile(argv[1]);
+  } else if (strcmp(argv[arg], "-") == 0) {
+    runStdin();
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
-    exit(64);
+    runFile(argv[arg]);
   }
 
+  stopSampling();
   freeVM();
 
   return 0;
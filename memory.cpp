@@ -1,29 +1,191 @@
 #include "memory.h"
 
 #include "compiler.h"
+#include "heap.h"
+#include "lims.h"
 #include "object.h"
+#include "sampler.h"
 #include "vm.h"
 
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 #ifdef DEBUG_LOG_GC
 #include "debug.h"
 #include <cstdio>
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+// clang-format off
+#define FREE_OBJ(type, pointer) freeObjectSlot(pointer, sizeof(type))
+// clang-format on
 
-void*
-reallocate(void* pointer, size_t oldSize, size_t newSize) {
-  vm.bytesAllocated += newSize - oldSize;
-  if (newSize > oldSize) {
+GCConfig
+defaultGCConfig() {
+  return GCConfig{1024 * 1024, 2, 0, SIZE_MAX, 0, 0, 0};
+}
+
+bool
+parseByteSize(const char* text, size_t* bytes) {
+  char* end;
+  errno = 0;
+  const unsigned long long count = strtoull(text, &end, 10);
+  if (end == text || errno != 0 || text[0] == '-') {
+    return false;
+  }
+
+  int shift = 0;
+  switch (*end) {
+  case 'K':
+  case 'k':
+    shift = 10;
+    end++;
+    break;
+  case 'M':
+  case 'm':
+    shift = 20;
+    end++;
+    break;
+  case 'G':
+  case 'g':
+    shift = 30;
+    end++;
+    break;
+  }
+  if (*end != '\0' || count > (SIZE_MAX >> shift)) {
+    return false;
+  }
+  *bytes = (size_t)count << shift;
+  return true;
+}
+
+bool
+parseGrowFactor(const char* text, double* factor) {
+  char* end;
+  const double value = strtod(text, &end);
+  if (end == text || *end != '\0' || !(value >= 1 && value <= 1024)) {
+    return false;
+  }
+  *factor = value;
+  return true;
+}
+
+bool
+parseMarkThreads(const char* text, int* threads) {
+  char* end;
+  const long value = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || value < 0 || value > lims::GC_MARKERS_MAX) {
+    return false;
+  }
+  *threads = (int)value;
+  return true;
+}
+
+bool
+parseHeapShare(const char* text, double* share) {
+  char* end;
+  const double value = strtod(text, &end);
+  if (end == text || *end != '\0' || !(value >= 0 && value <= 1)) {
+    return false;
+  }
+  *share = value;
+  return true;
+}
+
+const char*
+gcConfigFromEnv(GCConfig* config) {
+  const char* value;
+  if ((value = getenv("CLOX_GC_INITIAL")) != nullptr && !parseByteSize(value, &(config->initialThreshold))) {
+    return "CLOX_GC_INITIAL";
+  }
+  if ((value = getenv("CLOX_GC_GROW_FACTOR")) != nullptr && !parseGrowFactor(value, &(config->growFactor))) {
+    return "CLOX_GC_GROW_FACTOR";
+  }
+  if ((value = getenv("CLOX_GC_MIN_HEAP")) != nullptr && !parseByteSize(value, &(config->minThreshold))) {
+    return "CLOX_GC_MIN_HEAP";
+  }
+  if ((value = getenv("CLOX_GC_MAX_HEAP")) != nullptr && !parseByteSize(value, &(config->maxThreshold))) {
+    return "CLOX_GC_MAX_HEAP";
+  }
+  if ((value = getenv("CLOX_HEAP_LIMIT")) != nullptr && !parseByteSize(value, &(config->heapLimit))) {
+    return "CLOX_HEAP_LIMIT";
+  }
+  if ((value = getenv("CLOX_GC_MARK_THREADS")) != nullptr && !parseMarkThreads(value, &(config->markThreads))) {
+    return "CLOX_GC_MARK_THREADS";
+  }
+  if ((value = getenv("CLOX_GC_COMPACT_AT")) != nullptr && !parseHeapShare(value, &(config->compactAt))) {
+    return "CLOX_GC_COMPACT_AT";
+  }
+  return nullptr;
+}
+
+static size_t
+nextThreshold(size_t liveBytes) {
+  const GCConfig* config = &(vm.gcConfig);
+  const double target = (double)liveBytes * config->growFactor;
+  const size_t threshold = target >= (double)config->maxThreshold ? config->maxThreshold : (size_t)target;
+  return threshold < config->minThreshold ? config->minThreshold : threshold;
+}
+
+static void
+sweepPages(int count);
+
+static void
+freeDeadObject(Obj* object, void* context);
+
+/**
+ * Count `bytes` more as allocated; this is where collections and the lazy sweep happen.
+ */
+static void
+growHeap(size_t bytes) {
+  vm.bytesAllocated += bytes;
+  bool collected = false;
 #ifdef DEBUG_STRESS_GC
-    collectGarbage();
+  collectGarbage();
+  collected = true;
 #endif
+
+  if (vm.heap.unsweptCount > 0) {
+    sweepPages(lims::GC_SWEEP_SLICE);
   }
 
-  if (vm.bytesAllocated > vm.nextGC) {
+  // NOTE: only growth may start a collection or sweep; a free made by sweepPages() must not start another one
+  if (vm.bytesAllocated > vm.nextGC && !collected) {
     collectGarbage();
+    collected = true;
+  }
+
+  const size_t limit = vm.gcConfig.heapLimit;
+  if (limit != 0 && vm.bytesAllocated > limit) {
+    if (!collected) {
+      collectGarbage();
+    }
+    finishSweep();
+    if (vm.bytesAllocated > limit) {
+      vm.bytesAllocated -= bytes;
+      throw OutOfMemory{bytes, limit};
+    }
+  }
+}
+
+void*
+reallocate(void* pointer, size_t oldSize, size_t newSize) {
+  if (newSize > oldSize) {
+    growHeap(newSize - oldSize);
+  } else {
+    vm.bytesAllocated -= oldSize - newSize;
   }
 
   if (newSize == 0) {
@@ -33,17 +195,283 @@ reallocate(void* pointer, size_t oldSize, size_t newSize) {
 
   void* result = realloc(pointer, newSize);
   if (result == nullptr) {
-    exit(1);
+    vm.bytesAllocated -= newSize - oldSize;
+    throw OutOfMemory{newSize - oldSize, 0};
   }
   return result;
 }
 
+void*
+allocateObjectSlot(size_t size) {
+  growHeap(size);
+
+  const int unswept = vm.heap.unsweptCount;
+  void* slot = heapAllocate(&(vm.heap), size, freeDeadObject, nullptr);
+  if (unswept > 0) {
+    sweepPages(0); // heapAllocate() may have swept the last pages
+  }
+
+  if (slot == nullptr) {
+    vm.bytesAllocated -= size;
+    throw OutOfMemory{size, 0};
+  }
+  return slot;
+}
+
+void
+freeObjectSlot(void* object, size_t size) {
+  vm.bytesAllocated -= size;
+  heapRelease(object);
+}
+
+// Parallel marking. Once the roots are marked, the gray objects are dealt out to `markerCount` markers, one per thread.
+// A marker works off a private stack; when that holds more than a batch and its shared stack is empty, it moves a batch
+// there. A marker that runs dry takes its own shared stack back or steals half of another's. The mark bit is set with
+// an atomic or, so exactly one marker blackens each object. Marking ends once every marker is idle and every
+// shared stack is empty.
+//
+// markers[0] is the collecting thread. The threads of the others are started by the first collection that needs them
+// and then kept in a pool: between collections they wait on a condition variable.
+#if defined(__GNUC__) && !defined(DEBUG_LOG_GC)
+#define GC_PARALLEL_MARK
+#endif
+
+#define MARK_BATCH 128
+
+struct MarkStack {
+  Obj** items;
+  int count;
+  int capacity;
+};
+
+struct Marker {
+  MarkStack local;
+  std::mutex lock;
+  MarkStack shared;
+  std::atomic<int> sharedCount;
+};
+
+static Marker markers[lims::GC_MARKERS_MAX];
+static int markerCount = 0;
+static std::atomic<int> idleMarkers{0};
+static thread_local Marker* currentMarker = nullptr;
+
+static void
+pushGray(MarkStack* stack, Obj* object) {
+  if (stack->capacity < stack->count + 1) {
+    stack->capacity = GROW_CAPACITY(stack->capacity);
+    // NOTE: `realloc` directly, as for vm.grayStack; this runs on the marker threads
+    stack->items = (Obj**)realloc(stack->items, sizeof(Obj*) * stack->capacity);
+    if (stack->items == nullptr) {
+      exit(1);
+    }
+  }
+  stack->items[stack->count++] = object;
+}
+
+static void
+shareBatch(Marker* marker) {
+  std::lock_guard<std::mutex> guard(marker->lock);
+  for (int i = 0; i < MARK_BATCH; i++) {
+    pushGray(&(marker->shared), marker->local.items[--marker->local.count]);
+  }
+  marker->sharedCount.store(marker->shared.count, std::memory_order_relaxed);
+}
+
+/**
+ * Refill the empty private stack of `thief`: all of its own shared stack, or else half of another marker's.
+ */
+static bool
+stealGray(Marker* thief) {
+  const int self = (int)(thief - markers);
+  for (int i = 0; i < markerCount; i++) {
+    Marker* victim = &(markers[(self + i) % markerCount]);
+    if (victim->sharedCount.load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+
+    std::lock_guard<std::mutex> guard(victim->lock);
+    const int take = victim == thief ? victim->shared.count : (victim->shared.count + 1) / 2;
+    for (int j = 0; j < take; j++) {
+      pushGray(&(thief->local), victim->shared.items[--victim->shared.count]);
+    }
+    victim->sharedCount.store(victim->shared.count, std::memory_order_relaxed);
+    if (thief->local.count > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool
+anySharedGray() {
+  for (int i = 0; i < markerCount; i++) {
+    if (markers[i].sharedCount.load(std::memory_order_relaxed) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void
+blackenObject(Obj* object);
+
+static void
+runMarker(Marker* marker) {
+  currentMarker = marker;
+  for (;;) {
+    while (marker->local.count > 0) {
+      if (marker->local.count > MARK_BATCH && marker->sharedCount.load(std::memory_order_relaxed) == 0) {
+        shareBatch(marker);
+      }
+      blackenObject(marker->local.items[--marker->local.count]);
+    }
+    if (stealGray(marker)) {
+      continue;
+    }
+
+    idleMarkers.fetch_add(1);
+    for (;;) {
+      if (idleMarkers.load() == markerCount && !anySharedGray()) {
+        currentMarker = nullptr;
+        return;
+      }
+      if (anySharedGray()) {
+        idleMarkers.fetch_sub(1);
+        break;
+      }
+      std::this_thread::yield();
+    }
+  }
+}
+
+struct MarkerPool {
+  std::mutex lock;
+  std::condition_variable wake; // a collection bumped `round`
+  std::condition_variable done; // `running` dropped to 0
+  uint64_t round;
+  int running; // pool threads still marking in this round
+  int started; // pool threads, for markers[1] to markers[started]
+};
+
+// NOTE: never freed, the parked threads outlive the VM and wait on it until the process exits
+static MarkerPool* pool = nullptr;
+
+static void
+runMarkerThread(int index, uint64_t round) {
+#if defined(__unix__) || defined(__APPLE__)
+  // Signals such as the sampler's SIGPROF belong to the mutator thread.
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+#endif
+  std::unique_lock<std::mutex> guard(pool->lock);
+  for (;;) {
+    pool->wake.wait(guard, [round] { return pool->round != round; });
+    round = pool->round;
+    if (index >= markerCount) {
+      continue; // NOTE: this collection needs fewer markers
+    }
+
+    guard.unlock();
+    runMarker(&(markers[index]));
+    guard.lock();
+    pool->running -= 1;
+    if (pool->running == 0) {
+      pool->done.notify_one();
+    }
+  }
+}
+
+/**
+ * Make sure the pool has `threads` threads, as far as they can be started; returns how many it has.
+ */
+static int
+startMarkerThreads(int threads) {
+  if (pool == nullptr) {
+    pool = new MarkerPool();
+    pool->round = 0;
+    pool->running = 0;
+    pool->started = 0;
+  }
+  while (pool->started < threads) {
+    try {
+      std::thread(runMarkerThread, pool->started + 1, pool->round).detach();
+    } catch (const std::system_error&) {
+      break;
+    }
+    pool->started += 1;
+  }
+  return pool->started;
+}
+
+/**
+ * Number of markers for a collection that starts with `heapBytes` allocated; 1 marks on this thread alone.
+ */
+static int
+markersFor(size_t heapBytes) {
+#ifdef GC_PARALLEL_MARK
+  if (heapBytes < lims::GC_PARALLEL_MARK_MIN) {
+    return 1;
+  }
+  int count = vm.gcConfig.markThreads;
+  if (count == 0) {
+    count = (int)std::thread::hardware_concurrency();
+  }
+  return count < 1 ? 1 : (count > lims::GC_MARKERS_MAX ? lims::GC_MARKERS_MAX : count);
+#else
+  return 1;
+#endif
+}
+
+static void
+traceParallel(int count) {
+  const int threads = startMarkerThreads(count - 1);
+  count = threads + 1 < count ? threads + 1 : count;
+  if (count == 1) {
+    while (vm.grayCount > 0) {
+      blackenObject(vm.grayStack[--vm.grayCount]);
+    }
+    return;
+  }
+
+  idleMarkers.store(0);
+  for (int i = 0; i < vm.grayCount; i++) {
+    pushGray(&(markers[i % count].shared), vm.grayStack[i]);
+  }
+  vm.grayCount = 0;
+  for (int i = 0; i < count; i++) {
+    markers[i].sharedCount.store(markers[i].shared.count, std::memory_order_relaxed);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(pool->lock);
+    markerCount = count;
+    pool->running = count - 1;
+    pool->round += 1;
+  }
+  pool->wake.notify_all();
+
+  runMarker(&(markers[0]));
+
+  std::unique_lock<std::mutex> guard(pool->lock);
+  pool->done.wait(guard, [] { return pool->running == 0; });
+}
+
 void
 markObject(Obj* object) {
   if (object == nullptr) {
     return;
   }
-  if (object->isMarked) {
+#ifdef GC_PARALLEL_MARK
+  if (currentMarker != nullptr) {
+    if (setMarkedAtomic(object)) {
+      pushGray(&(currentMarker->local), object);
+    }
+    return;
+  }
+#endif
+  if (!setMarked(object)) {
     return;
   }
 
@@ -53,8 +481,6 @@ markObject(Obj* object) {
   printf("\n");
 #endif
 
-  object->isMarked = true;
-
   if (vm.grayCapacity < vm.grayCount + 1) {
     vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
     // NOTE: use `realloc` directly
@@ -93,7 +519,10 @@ blackenObject(Obj* object) {
   case ObjType::OBJ_CLASS: {
     ObjClass* klass = (ObjClass*)object;
     markObject((Obj*)klass->name);
-    markTable(&(klass->methods));
+    markObject((Obj*)klass->superclass);
+    if (!klass->sharesMethods) { // NOTE: else the superclass marks them
+      markTable(&(klass->methods));
+    }
     break;
   }
   case ObjType::OBJ_CLOSURE: {
@@ -104,6 +533,8 @@ blackenObject(Obj* object) {
     }
     break;
   }
+  case ObjType::OBJ_FLOAT64_ARRAY:
+    break;
   case ObjType::OBJ_FUNCTION: {
     ObjFunction* function = (ObjFunction*)object;
     function->gcMark();
@@ -115,12 +546,26 @@ blackenObject(Obj* object) {
     markTable(&(instance->fields));
     break;
   }
+  case ObjType::OBJ_LIST: {
+    ObjList* list = (ObjList*)object;
+    list->gcMark();
+    break;
+  }
+  case ObjType::OBJ_MAP: {
+    markValueTable(&(((ObjMap*)object)->entries));
+    break;
+  }
   case ObjType::OBJ_UPVALUE: {
     markValue(((ObjUpvalue*)object)->closed);
     break;
   }
+  case ObjType::OBJ_STRING: {
+    ObjString* string = (ObjString*)object;
+    markObject((Obj*)(string->left));
+    markObject((Obj*)(string->right));
+    break;
+  }
   case ObjType::OBJ_NATIVE:
-  case ObjType::OBJ_STRING:
     break;
   }
 }
@@ -133,44 +578,68 @@ freeObject(Obj* object) {
 
   switch (object->type) {
   case ObjType::OBJ_BOUND_METHOD: {
-    FREE(ObjBoundMethod, object);
+    FREE_OBJ(ObjBoundMethod, object);
     break;
   }
   case ObjType::OBJ_CLASS: {
     ObjClass* klass = (ObjClass*)object;
-    freeTable(&(klass->methods));
-    FREE(ObjClass, object);
+    if (!klass->sharesMethods) {
+      freeTable(&(klass->methods));
+    }
+    FREE_OBJ(ObjClass, object);
     break;
   }
   case ObjType::OBJ_CLOSURE: {
     ObjClosure* closure = (ObjClosure*)object;
     FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-    FREE(ObjClosure, object);
+    FREE_OBJ(ObjClosure, object);
+    break;
+  }
+  case ObjType::OBJ_FLOAT64_ARRAY: {
+    ObjFloat64Array* array = (ObjFloat64Array*)object;
+    FREE_ARRAY(double, array->values, array->length);
+    FREE_OBJ(ObjFloat64Array, object);
     break;
   }
   case ObjType::OBJ_FUNCTION: {
     ObjFunction* function = (ObjFunction*)object;
+#ifdef DEBUG_PROFILE
+    profileFunctionFreed(function);
+#endif
     delete function;
     break;
   }
   case ObjType::OBJ_INSTANCE: {
     ObjInstance* instance = (ObjInstance*)object;
     freeTable(&(instance->fields));
-    FREE(ObjInstance, object);
+    FREE_OBJ(ObjInstance, object);
+    break;
+  }
+  case ObjType::OBJ_LIST: {
+    ObjList* list = (ObjList*)object;
+    delete list;
+    break;
+  }
+  case ObjType::OBJ_MAP: {
+    ObjMap* map = (ObjMap*)object;
+    freeValueTable(&(map->entries));
+    FREE_OBJ(ObjMap, object);
     break;
   }
   case ObjType::OBJ_NATIVE: {
-    FREE(ObjNative, object);
+    FREE_OBJ(ObjNative, object);
     break;
   }
   case ObjType::OBJ_STRING: {
     ObjString* string = (ObjString*)object;
-    FREE_ARRAY(char, string->chars, string->length + 1);
-    FREE(ObjString, object);
+    if (string->chars != nullptr) {
+      FREE_ARRAY(char, string->chars, string->length + 1);
+    }
+    FREE_OBJ(ObjString, object);
     break;
   }
   case ObjType::OBJ_UPVALUE: {
-    FREE(ObjUpvalue, object);
+    FREE_OBJ(ObjUpvalue, object);
     break;
   }
   }
@@ -186,75 +655,354 @@ markRoots() {
     markObject((Obj*)(vm.frames[i].closure));
   }
 
-  for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != nullptr; upvalue = upvalue->next) {
-    markObject((Obj*)upvalue);
+  for (int word = 0; word < lims::STACK_MAX / 64; word++) {
+    for (uint64_t bits = vm.openSlots[word]; bits != 0; bits &= bits - 1) {
+      markObject((Obj*)(vm.openUpvalues[word * 64 + lowestBit(bits)]));
+    }
   }
 
   markTable(&(vm.globals));
+  markTable(&(vm.listMethods));
+  markTable(&(vm.mapMethods));
+  markTable(&(vm.float64ArrayMethods));
   markCompilerRoots();
   markObject((Obj*)(vm.initString));
 }
 
 static void
 traceReferences() {
+  const int count = markersFor(vm.bytesAllocated);
+  if (count > 1) {
+    traceParallel(count);
+    return;
+  }
+
   while (vm.grayCount > 0) {
     Obj* object = vm.grayStack[--vm.grayCount];
     blackenObject(object);
   }
 }
 
+static uint64_t
+nanosSince(std::chrono::steady_clock::time_point start) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+    .count();
+}
+
+static int
+pauseBucket(uint64_t nanos) {
+  int bucket = 0;
+  for (uint64_t micros = nanos / 1000; micros > 0 && bucket < GC_PAUSE_BUCKETS - 1; micros >>= 1) {
+    bucket++;
+  }
+  return bucket;
+}
+
+void
+resetGCStats(GCStats* stats) {
+  memset(stats, 0, sizeof(GCStats));
+}
+
 static void
-sweep() {
-  Obj* previous = nullptr;
-  Obj* object = vm.objects;
-  while (object != nullptr) {
-    if (object->isMarked) {
-      object->isMarked = false;
-      previous = object;
-      object = object->next;
-    } else {
-      Obj* unreached = object;
-      object = object->next;
-      if (previous != nullptr) {
-        previous->next = object;
-      } else {
-        vm.objects = object;
-      }
+countObject(Obj* object, void* context) {
+  ((size_t*)context)[(int)(object->type)] += 1;
+}
 
-      freeObject(unreached);
-    }
+void
+countObjects(size_t* counts) {
+  finishSweep();
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+    counts[i] = 0;
+  }
+  heapEach(&(vm.heap), countObject, counts);
+}
+
+// Sweeping is lazy. A collection only marks, then marks every heap page unswept. Each allocation that grows the heap
+// sweeps a page, and taking a slot sweeps the pages of its size class until one has room, so new objects never land
+// on an unswept page. The next collection, or anything that walks the heap, finishes the sweep first. The intern table
+// is cleaned while marking is done, so no lookup can hand out a dead string in between.
+
+static bool sweeping = false;
+static size_t sweepStartBytes = 0;
+static uint64_t compactedAt = 0; // the collection the last compaction started with
+
+/**
+ * Whether the swept heap has enough pages that only hold fragmentation to be worth a compaction.
+ */
+static bool
+fragmented() {
+  const double compactAt = vm.gcConfig.compactAt;
+  const int pageCount = vm.heap.pageCount;
+  if (compactAt <= 0 || pageCount < lims::GC_COMPACT_MIN_PAGES ||
+      vm.gcStats.collections < compactedAt + lims::GC_COMPACT_INTERVAL) {
+    return false;
+  }
+  return heapReclaimablePages(&(vm.heap)) >= compactAt * pageCount;
+}
+
+static void
+endSweep() {
+  GCStats* stats = &(vm.gcStats);
+  sweeping = false;
+  vm.nextGC = nextThreshold(vm.bytesAllocated);
+  stats->history[(stats->collections - 1) % GC_HISTORY_SIZE] = GCSnapshot{vm.bytesAllocated, vm.nextGC};
+  if (fragmented()) {
+    vm.compactPending = true;
+  }
+
+#ifdef DEBUG_LOG_GC
+  printf("-- sweep end\n");
+  printf("   heap %zu bytes (from %zu) next at %zu\n", vm.bytesAllocated, sweepStartBytes, vm.nextGC);
+#endif
+}
+
+static void
+freeDeadObject(Obj* object, void* context) {
+  const size_t before = vm.bytesAllocated;
+  freeObject(object);
+  vm.gcStats.objectsFreed += 1;
+  vm.gcStats.bytesFreed += before - vm.bytesAllocated;
+}
+
+static void
+sweepPages(int count) {
+  if (!sweeping) {
+    return;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  sweepHeapPages(&(vm.heap), count, freeDeadObject, nullptr);
+  vm.gcStats.sweepNanos += nanosSince(start);
+  if (vm.heap.unsweptCount == 0) {
+    endSweep();
   }
 }
 
+void
+finishSweep() {
+  sweepPages(INT32_MAX);
+}
+
+static void
+freeAnyObject(Obj* object, void* context) {
+  freeObject(object);
+}
+
 void
 freeObjects() {
-  Obj* object = vm.objects;
-  while (object != nullptr) {
-    Obj* next = object->next;
-    freeObject(object);
-    object = next;
-  }
+  heapEach(&(vm.heap), freeAnyObject, nullptr);
+  freeHeap(&(vm.heap));
+  sweeping = false;
+  compactedAt = 0;
 
   free(vm.grayStack);
+  for (Marker& marker : markers) {
+    free(marker.local.items);
+    free(marker.shared.items);
+    marker.local = MarkStack{nullptr, 0, 0};
+    marker.shared = MarkStack{nullptr, 0, 0};
+  }
 }
 
 void
 collectGarbage() {
 #ifdef DEBUG_LOG_GC
   printf("-- gc begin\n");
-  size_t before = vm.bytesAllocated;
 #endif
+  GCStats* stats = &(vm.gcStats);
+  const auto start = std::chrono::steady_clock::now();
+
+  // The mark bits of the last collection are still set on the objects it has not swept yet.
+  finishSweep();
+
+  // Samples point at functions; name them while those are certainly still alive.
+  drainSamples();
 
+  auto phaseStart = std::chrono::steady_clock::now();
   markRoots();
+  stats->markRootsNanos += nanosSince(phaseStart);
+
+  phaseStart = std::chrono::steady_clock::now();
   traceReferences();
-  tableRemoveWhite(&(vm.strings));
-  sweep();
+  stats->traceNanos += nanosSince(phaseStart);
 
-  vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+  phaseStart = std::chrono::steady_clock::now();
+  tableRemoveWhite(&(vm.strings));
+  stats->removeWhiteNanos += nanosSince(phaseStart);
+
+  // Collect no more until the sweep is done; endSweep() sets the threshold from what is left then.
+  heapStartSweep(&(vm.heap));
+  sweeping = true;
+  vm.nextGC = SIZE_MAX;
+  sweepStartBytes = vm.bytesAllocated;
+  sweepPages(0);
+
+  const uint64_t pause = nanosSince(start);
+  stats->collections += 1;
+  stats->totalPauseNanos += pause;
+  stats->lastPauseNanos = pause;
+  stats->maxPauseNanos = pause > stats->maxPauseNanos ? pause : stats->maxPauseNanos;
+  stats->pauseHistogram[pauseBucket(pause)] += 1;
 
 #ifdef DEBUG_LOG_GC
   printf("-- gc end\n");
-  printf("   collect %zu bytes (from %zu to %zu) next at %zu\n", before - vm.bytesAllocated, before, vm.bytesAllocated,
-         vm.nextGC);
+#endif
+}
+
+// Compaction. A full collection and sweep leave only live objects; the sparsest pages are then taken out of the heap
+// and their objects copied into the free slots of the rest, each leaving its new address behind in its old slot. Every
+// reference, from the roots and from the objects that stay, is then looked up through forwardedObject(), and the
+// emptied pages are released. Objects move, so this runs only where run() holds no object pointers of its own.
+
+template <typename T>
+static inline void
+relocate(T** pointer) {
+  if (*pointer != nullptr) {
+    *pointer = (T*)forwardedObject((Obj*)*pointer);
+  }
+}
+
+void
+relocateValue(Value* value) {
+  if (IS_OBJ(*value)) {
+    *value = OBJ_VAL(forwardedObject(AS_OBJ(*value)));
+  }
+}
+
+static void
+evacuateObject(Obj* object, void* context) {
+  Obj* copy = heapEvacuate(&(vm.heap), object);
+  if (copy->type == ObjType::OBJ_UPVALUE) {
+    // A closed upvalue points at its own `closed`.
+    ObjUpvalue* upvalue = (ObjUpvalue*)copy;
+    if (upvalue->location == &(((ObjUpvalue*)object)->closed)) {
+      upvalue->location = &(upvalue->closed);
+    }
+  }
+  *(uint64_t*)context += 1;
+}
+
+static void
+relocateReferences(Obj* object, void* context) {
+  switch (object->type) {
+  case ObjType::OBJ_BOUND_METHOD: {
+    ObjBoundMethod* bound = (ObjBoundMethod*)object;
+    relocateValue(&(bound->receiver));
+    relocate(&(bound->method));
+    break;
+  }
+  case ObjType::OBJ_CLASS: {
+    ObjClass* klass = (ObjClass*)object;
+    relocate(&(klass->name));
+    relocate(&(klass->superclass));
+    if (!klass->sharesMethods) {
+      relocateTable(&(klass->methods));
+    }
+    break;
+  }
+  case ObjType::OBJ_CLOSURE: {
+    ObjClosure* closure = (ObjClosure*)object;
+    relocate(&(closure->function));
+    for (int i = 0; i < closure->upvalueCount; i++) {
+      relocate(&(closure->upvalues[i]));
+    }
+    break;
+  }
+  case ObjType::OBJ_FLOAT64_ARRAY:
+    break;
+  case ObjType::OBJ_FUNCTION: {
+    ((ObjFunction*)object)->gcRelocate();
+    break;
+  }
+  case ObjType::OBJ_INSTANCE: {
+    ObjInstance* instance = (ObjInstance*)object;
+    relocate(&(instance->klass));
+    relocateTable(&(instance->fields));
+    break;
+  }
+  case ObjType::OBJ_LIST: {
+    ((ObjList*)object)->gcRelocate();
+    break;
+  }
+  case ObjType::OBJ_MAP: {
+    relocateValueTable(&(((ObjMap*)object)->entries));
+    break;
+  }
+  case ObjType::OBJ_UPVALUE: {
+    relocateValue(&(((ObjUpvalue*)object)->closed));
+    break;
+  }
+  case ObjType::OBJ_STRING: {
+    ObjString* string = (ObjString*)object;
+    relocate(&(string->left));
+    relocate(&(string->right));
+    break;
+  }
+  case ObjType::OBJ_NATIVE:
+    break;
+  }
+}
+
+static void
+relocateRoots() {
+  for (Value* slot = vm.stack.bottom(); slot < vm.stack.top(); slot++) { // NOTE: pointer self increment
+    relocateValue(slot);
+  }
+
+  for (int i = 0; i < vm.frames.count; i++) {
+    relocate(&(vm.frames[i].closure));
+  }
+
+  for (int word = 0; word < lims::STACK_MAX / 64; word++) {
+    for (uint64_t bits = vm.openSlots[word]; bits != 0; bits &= bits - 1) {
+      relocate(&(vm.openUpvalues[word * 64 + lowestBit(bits)]));
+    }
+  }
+  relocateTable(&(vm.globals));
+  relocateTable(&(vm.strings));
+  relocateTable(&(vm.listMethods));
+  relocateTable(&(vm.mapMethods));
+  relocateTable(&(vm.float64ArrayMethods));
+  relocate(&(vm.initString));
+}
+
+void
+compactGarbage() {
+#if defined(__unix__) || defined(__APPLE__)
+  // The sampler's handler reads vm.frames; it must not see a closure that is being moved.
+  sigset_t profiling;
+  sigset_t previous;
+  sigemptyset(&profiling);
+  sigaddset(&profiling, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &profiling, &previous);
+#endif
+
+  GCStats* stats = &(vm.gcStats);
+  const auto start = std::chrono::steady_clock::now();
+  collectGarbage();
+  compactedAt = stats->collections;
+  finishSweep();
+
+  const int pagesBefore = vm.heap.pageCount;
+  HeapPage* sparse = heapTakeSparsePages(&(vm.heap));
+  uint64_t moved = 0;
+  heapEachOnPages(sparse, evacuateObject, &moved);
+  relocateRoots();
+  heapEach(&(vm.heap), relocateReferences, nullptr);
+  heapReleasePages(&(vm.heap), sparse);
+
+  stats->compactions += 1;
+  stats->objectsMoved += moved;
+  stats->compactNanos += nanosSince(start);
+  vm.compactPending = false;
+
+#ifdef DEBUG_LOG_GC
+  printf("-- compact: moved %llu objects, released %d of %d pages\n", (unsigned long long)moved,
+         pagesBefore - vm.heap.pageCount, pagesBefore);
+#else
+  (void)pagesBefore;
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
 #endif
 }
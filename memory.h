@@ -27,18 +27,146 @@ struct Value;
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 // clang-format on
 
+/**
+ * Collector tuning, read by initVM(). Sizes are in bytes.
+ */
+struct GCConfig {
+  size_t initialThreshold; // heap size that starts the first collection
+  double growFactor;       // after a collection the next one starts at the live size times this...
+  size_t minThreshold;     // ...but never below this
+  size_t maxThreshold;     // ...nor above this; a heap past it collects on every allocation
+  size_t heapLimit;        // 0 for none; past it an allocation collects first and then fails with OutOfMemory
+  int markThreads;         // threads that mark a large heap; 0 for one per core, 1 to mark on the mutator thread only
+  double compactAt;        // 0 for never; else compact once this share of the heap pages holds only fragmentation
+};
+
+/**
+ * Thrown by reallocate() when an allocation would exceed GCConfig::heapLimit or the system is out of memory; interpret()
+ * turns it into a runtime error.
+ */
+struct OutOfMemory {
+  size_t requested;
+  size_t heapLimit; // 0 when the system allocator failed
+};
+
+GCConfig
+defaultGCConfig();
+
+/**
+ * Parse a byte count with an optional K, M or G suffix, e.g. "64M".
+ */
+bool
+parseByteSize(const char* text, size_t* bytes);
+
+/**
+ * Parse a growth factor; it must be at least 1.
+ */
+bool
+parseGrowFactor(const char* text, double* factor);
+
+bool
+parseMarkThreads(const char* text, int* threads);
+
+/**
+ * Parse a share of the heap, from 0 to 1.
+ */
+bool
+parseHeapShare(const char* text, double* share);
+
+/**
+ * Override `config` with the CLOX_GC_INITIAL, CLOX_GC_GROW_FACTOR, CLOX_GC_MIN_HEAP, CLOX_GC_MAX_HEAP,
+ * CLOX_HEAP_LIMIT, CLOX_GC_MARK_THREADS and CLOX_GC_COMPACT_AT environment variables that are set. Returns the name of
+ * the first malformed one, or nullptr.
+ */
+const char*
+gcConfigFromEnv(GCConfig* config);
+
+constexpr int GC_PAUSE_BUCKETS = 16;
+constexpr int GC_HISTORY_SIZE = 32;
+
+/**
+ * Heap size right after a collection and the threshold it set for the next one.
+ */
+struct GCSnapshot {
+  size_t liveBytes;
+  size_t nextGC;
+};
+
+/**
+ * Running totals over every collection since initVM(). Bucket i of `pauseHistogram` counts the pauses shorter than
+ * 2^i microseconds that did not fit an earlier bucket; the last bucket takes everything longer.
+ */
+struct GCStats {
+  uint64_t collections;
+  uint64_t markRootsNanos;
+  uint64_t traceNanos;
+  uint64_t removeWhiteNanos;
+  uint64_t sweepNanos;
+  uint64_t totalPauseNanos;
+  uint64_t lastPauseNanos;
+  uint64_t maxPauseNanos;
+  uint64_t bytesFreed;
+  uint64_t objectsFreed;
+  uint64_t compactions;
+  uint64_t compactNanos; // pauses of the compactions, on top of the collections they start with
+  uint64_t objectsMoved;
+  uint64_t pauseHistogram[GC_PAUSE_BUCKETS];
+  GCSnapshot history[GC_HISTORY_SIZE]; // collection n (counting from 1) is at (n - 1) % GC_HISTORY_SIZE
+};
+
+void
+resetGCStats(GCStats* stats);
+
+/**
+ * Count the live objects by type into counts[0 .. OBJ_TYPE_COUNT - 1].
+ */
+void
+countObjects(size_t* counts);
+
 void*
 reallocate(void* pointer, size_t oldSize, size_t newSize);
 
+/**
+ * Take a slot of the object heap for the struct of a new object. It counts like an allocation with reallocate(), so
+ * it may collect first.
+ */
+void*
+allocateObjectSlot(size_t size);
+
+void
+freeObjectSlot(void* object, size_t size);
+
 void
 markObject(Obj* object);
 
 void
 markValue(Value value);
 
+/**
+ * Point `value` at where its object has been moved to by a compaction.
+ */
+void
+relocateValue(Value* value);
+
+/**
+ * Mark, and hand the unmarked objects over to the lazy sweep; the pause does not include freeing them.
+ */
 void
 collectGarbage();
 
+/**
+ * Sweep what the last collection left unswept.
+ */
+void
+finishSweep();
+
+/**
+ * Collect, then move the objects of sparse heap pages into the free slots of the others and release the emptied pages.
+ * Only for safepoints: every object pointer outside the heap, other than the VM's roots, is stale afterwards.
+ */
+void
+compactGarbage();
+
 void
 freeObjects();
 
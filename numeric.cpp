@@ -0,0 +1,209 @@
+#include "numeric.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// clang-format off
+#if defined(__AVX__)
+#define NUMERIC_LANES     4
+typedef __m256d Lanes;
+#define lanesLoad(p)      _mm256_loadu_pd(p)
+#define lanesStore(p, v)  _mm256_storeu_pd((p), (v))
+#define lanesSet(x)       _mm256_set1_pd(x)
+#define lanesAdd(a, b)    _mm256_add_pd((a), (b))
+#define lanesMul(a, b)    _mm256_mul_pd((a), (b))
+#define lanesMin(a, b)    _mm256_min_pd((a), (b))
+#define lanesMax(a, b)    _mm256_max_pd((a), (b))
+#elif defined(__SSE2__)
+#define NUMERIC_LANES     2
+typedef __m128d Lanes;
+#define lanesLoad(p)      _mm_loadu_pd(p)
+#define lanesStore(p, v)  _mm_storeu_pd((p), (v))
+#define lanesSet(x)       _mm_set1_pd(x)
+#define lanesAdd(a, b)    _mm_add_pd((a), (b))
+#define lanesMul(a, b)    _mm_mul_pd((a), (b))
+#define lanesMin(a, b)    _mm_min_pd((a), (b))
+#define lanesMax(a, b)    _mm_max_pd((a), (b))
+#endif
+// clang-format on
+
+// NOTE: min and max keep the accumulator unless the new value compares below (above) it, which is what minpd/maxpd
+// do with the accumulator as second operand. A NaN therefore never replaces a number.
+
+static inline double
+minOf(double value, double acc) {
+  return value < acc ? value : acc;
+}
+
+static inline double
+maxOf(double value, double acc) {
+  return value > acc ? value : acc;
+}
+
+#ifdef NUMERIC_LANES
+
+static inline double
+lanesSum(Lanes lanes) {
+  double parts[NUMERIC_LANES];
+  lanesStore(parts, lanes);
+  double sum = 0;
+  for (int i = 0; i < NUMERIC_LANES; i++) {
+    sum += parts[i];
+  }
+  return sum;
+}
+
+double
+sumFloat64(const double* values, int count) {
+  // Two accumulators hide the latency of the adds.
+  Lanes sum0 = lanesSet(0);
+  Lanes sum1 = lanesSet(0);
+  int i = 0;
+  for (; i + 2 * NUMERIC_LANES <= count; i += 2 * NUMERIC_LANES) {
+    sum0 = lanesAdd(sum0, lanesLoad(values + i));
+    sum1 = lanesAdd(sum1, lanesLoad(values + i + NUMERIC_LANES));
+  }
+
+  double sum = lanesSum(lanesAdd(sum0, sum1));
+  for (; i < count; i++) {
+    sum += values[i];
+  }
+  return sum;
+}
+
+double
+dotFloat64(const double* a, const double* b, int count) {
+  Lanes sum0 = lanesSet(0);
+  Lanes sum1 = lanesSet(0);
+  int i = 0;
+  for (; i + 2 * NUMERIC_LANES <= count; i += 2 * NUMERIC_LANES) {
+    sum0 = lanesAdd(sum0, lanesMul(lanesLoad(a + i), lanesLoad(b + i)));
+    sum1 = lanesAdd(sum1, lanesMul(lanesLoad(a + i + NUMERIC_LANES), lanesLoad(b + i + NUMERIC_LANES)));
+  }
+
+  double sum = lanesSum(lanesAdd(sum0, sum1));
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+void
+scaleFloat64(double* values, int count, double factor) {
+  const Lanes factors = lanesSet(factor);
+  int i = 0;
+  for (; i + NUMERIC_LANES <= count; i += NUMERIC_LANES) {
+    lanesStore(values + i, lanesMul(lanesLoad(values + i), factors));
+  }
+  for (; i < count; i++) {
+    values[i] *= factor;
+  }
+}
+
+void
+addFloat64(double* values, const double* addends, int count) {
+  int i = 0;
+  for (; i + NUMERIC_LANES <= count; i += NUMERIC_LANES) {
+    lanesStore(values + i, lanesAdd(lanesLoad(values + i), lanesLoad(addends + i)));
+  }
+  for (; i < count; i++) {
+    values[i] += addends[i];
+  }
+}
+
+double
+minFloat64(const double* values, int count) {
+  Lanes acc = lanesSet(values[0]);
+  int i = 1;
+  for (; i + NUMERIC_LANES <= count; i += NUMERIC_LANES) {
+    acc = lanesMin(lanesLoad(values + i), acc);
+  }
+
+  double parts[NUMERIC_LANES];
+  lanesStore(parts, acc);
+  double min = values[0];
+  for (int lane = 0; lane < NUMERIC_LANES; lane++) {
+    min = minOf(parts[lane], min);
+  }
+  for (; i < count; i++) {
+    min = minOf(values[i], min);
+  }
+  return min;
+}
+
+double
+maxFloat64(const double* values, int count) {
+  Lanes acc = lanesSet(values[0]);
+  int i = 1;
+  for (; i + NUMERIC_LANES <= count; i += NUMERIC_LANES) {
+    acc = lanesMax(lanesLoad(values + i), acc);
+  }
+
+  double parts[NUMERIC_LANES];
+  lanesStore(parts, acc);
+  double max = values[0];
+  for (int lane = 0; lane < NUMERIC_LANES; lane++) {
+    max = maxOf(parts[lane], max);
+  }
+  for (; i < count; i++) {
+    max = maxOf(values[i], max);
+  }
+  return max;
+}
+
+#else
+
+double
+sumFloat64(const double* values, int count) {
+  double sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum += values[i];
+  }
+  return sum;
+}
+
+double
+dotFloat64(const double* a, const double* b, int count) {
+  double sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+void
+scaleFloat64(double* values, int count, double factor) {
+  for (int i = 0; i < count; i++) {
+    values[i] *= factor;
+  }
+}
+
+void
+addFloat64(double* values, const double* addends, int count) {
+  for (int i = 0; i < count; i++) {
+    values[i] += addends[i];
+  }
+}
+
+double
+minFloat64(const double* values, int count) {
+  double min = values[0];
+  for (int i = 1; i < count; i++) {
+    min = minOf(values[i], min);
+  }
+  return min;
+}
+
+double
+maxFloat64(const double* values, int count) {
+  double max = values[0];
+  for (int i = 1; i < count; i++) {
+    max = maxOf(values[i], max);
+  }
+  return max;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef CLOX_NUMERIC_H
+#define CLOX_NUMERIC_H
+
+// Bulk kernels over packed doubles, vectorized with AVX or SSE2 when the compiler targets them. The vector versions
+// add in a different order than a plain loop, so sums may differ from it in the last bits.
+
+double
+sumFloat64(const double* values, int count);
+
+double
+dotFloat64(const double* a, const double* b, int count);
+
+void
+scaleFloat64(double* values, int count, double factor);
+
+/**
+ * values[i] += addends[i]
+ */
+void
+addFloat64(double* values, const double* addends, int count);
+
+/**
+ * NaNs after the first element are skipped. `count` must be positive.
+ */
+double
+minFloat64(const double* values, int count);
+
+/**
+ * NaNs after the first element are skipped. `count` must be positive.
+ */
+double
+maxFloat64(const double* values, int count);
+
+#endif
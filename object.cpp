@@ -1,5 +1,6 @@
 #include "object.h"
 
+#include "heap.h"
 #include "memory.h"
 #include "table.h"
 #include "value.h"
@@ -13,13 +14,15 @@
     (type*)allocateObject(sizeof(type), objectType)
 // clang-format on
 
+static_assert(sizeof(ObjFunction) <= HEAP_SLOT_MAX && sizeof(ObjList) <= HEAP_SLOT_MAX &&
+                  sizeof(ObjClass) <= HEAP_SLOT_MAX && sizeof(ObjInstance) <= HEAP_SLOT_MAX &&
+                  sizeof(ObjMap) <= HEAP_SLOT_MAX && sizeof(ObjString) <= HEAP_SLOT_MAX,
+              "every object must fit a heap slot");
+
 static Obj*
 allocateObject(size_t size, ObjType type) {
-  Obj* object = (Obj*)reallocate(NULL, 0, size);
+  Obj* object = (Obj*)allocateObjectSlot(size);
   object->type = type;
-  object->isMarked = false;
-  object->next = vm.objects;
-  vm.objects = object;
 
 #ifdef DEBUG_LOG_GC
   printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -30,29 +33,82 @@ allocateObject(size_t size, ObjType type) {
 
 Obj::
 Obj(const ObjType type)
-    : type{type}, isMarked{false} {
-  this->next = vm.objects;
-  vm.objects = this;
-}
+    : type{type} {}
 
 ObjFunction::
 ObjFunction()
-    : Obj{ObjType::OBJ_FUNCTION}, arity{0}, upvalueCount{0}, name{nullptr} {}
+    : Obj{ObjType::OBJ_FUNCTION}, arity{0}, upvalueCount{0}, name{nullptr}, bodySource{nullptr}, bodyLength{0},
+      bodyLine{0}, bodyIsMethod{false} {
+#ifdef DEBUG_PROFILE
+  this->profile = nullptr;
+#endif
+}
+
+ObjFunction::
+~ObjFunction() {
+  if (this->bodySource != nullptr) {
+    FREE_ARRAY(char, this->bodySource, this->bodyLength + 1);
+  }
+}
 
 void
 ObjFunction::gcMark() {
   markObject((Obj*)this->name);
   this->chunk.constants.gcMark();
+  // A cached bound method must not keep its receiver alive, nor a cached super method its class.
+  for (int i = 0; i < this->chunk.bindings.count; i++) {
+    this->chunk.bindings[i].bound = nullptr;
+  }
+  for (int i = 0; i < this->chunk.superCaches.count; i++) {
+    this->chunk.superCaches[i].superclass = nullptr;
+  }
+}
+
+void
+ObjFunction::gcRelocate() {
+  if (this->name != nullptr) {
+    this->name = (ObjString*)forwardedObject((Obj*)this->name);
+  }
+  this->chunk.constants.gcRelocate();
+  // NOTE: `bindings` and `superCaches` were cleared when the compaction marked
 }
 
 void*
 ObjFunction::operator new(size_t size) {
-  return reallocate(nullptr, 0, size);
+  return allocateObjectSlot(size);
 }
 
 void
 ObjFunction::operator delete(void* ptr) {
-  reallocate(ptr, sizeof(ObjFunction), 0);
+  freeObjectSlot(ptr, sizeof(ObjFunction));
+}
+
+ObjList::
+ObjList()
+    : Obj{ObjType::OBJ_LIST} {}
+
+void
+ObjList::gcMark() {
+  for (int i = 0; i < this->items.count; i++) {
+    markValue(this->items[i]);
+  }
+}
+
+void
+ObjList::gcRelocate() {
+  for (int i = 0; i < this->items.count; i++) {
+    relocateValue(&(this->items[i]));
+  }
+}
+
+void*
+ObjList::operator new(size_t size) {
+  return allocateObjectSlot(size);
+}
+
+void
+ObjList::operator delete(void* ptr) {
+  freeObjectSlot(ptr, sizeof(ObjList));
 }
 
 ObjBoundMethod*
@@ -67,24 +123,48 @@ ObjClass*
 newClass(ObjString* name) {
   ObjClass* klass = ALLOCATE_OBJ(ObjClass, ObjType::OBJ_CLASS);
   klass->name = name;
+  klass->superclass = nullptr;
   initTable(&(klass->methods));
+  klass->sharesMethods = false;
   return klass;
 }
 
 ObjClosure*
 newClosure(ObjFunction* function) {
+  // NOTE: the object comes first, so an OutOfMemory from either allocation leaves nothing for the collector to miss
+  ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, ObjType::OBJ_CLOSURE);
+  closure->function = function;
+  closure->upvalues = nullptr;
+  closure->upvalueCount = 0;
+
+  push(OBJ_VAL(closure));
   ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
   for (int i = 0; i < function->upvalueCount; i++) {
     upvalues[i] = nullptr;
   }
-
-  ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, ObjType::OBJ_CLOSURE);
-  closure->function = function;
   closure->upvalues = upvalues;
   closure->upvalueCount = function->upvalueCount;
+  pop();
   return closure;
 }
 
+ObjFloat64Array*
+newFloat64Array(int length) {
+  ObjFloat64Array* array = ALLOCATE_OBJ(ObjFloat64Array, ObjType::OBJ_FLOAT64_ARRAY);
+  array->length = 0;
+  array->values = nullptr;
+
+  push(OBJ_VAL(array));
+  double* values = ALLOCATE(double, length);
+  for (int i = 0; i < length; i++) {
+    values[i] = 0;
+  }
+  array->length = length;
+  array->values = values;
+  pop();
+  return array;
+}
+
 ObjFunction*
 newFunction() {
   return new ObjFunction{};
@@ -98,46 +178,152 @@ newInstance(ObjClass* klass) {
   return instance;
 }
 
+ObjList*
+newList() {
+  return new ObjList{};
+}
+
+ObjMap*
+newMap() {
+  ObjMap* map = ALLOCATE_OBJ(ObjMap, ObjType::OBJ_MAP);
+  initValueTable(&(map->entries));
+  return map;
+}
+
 ObjNative*
-newNative(NativeFn function) {
+newNative(NativeFn function, int minArity, int maxArity) {
   ObjNative* native = ALLOCATE_OBJ(ObjNative, ObjType::OBJ_NATIVE);
   native->function = function;
+  native->minArity = minArity;
+  native->maxArity = maxArity;
   return native;
 }
 
 static ObjString*
-allocateString(char* chars, int length, uint32_t hash) {
-  ObjString* string = ALLOCATE_OBJ(ObjString, ObjType::OBJ_STRING);
+allocateString(char* chars, int length, uint32_t hash, bool intern) {
+  // NOTE: `chars` is owned by the string from here on, and must not leak when the string can't be allocated
+  ObjString* string;
+  try {
+    string = ALLOCATE_OBJ(ObjString, ObjType::OBJ_STRING);
+  } catch (const OutOfMemory&) {
+    FREE_ARRAY(char, chars, length + 1);
+    throw;
+  }
   string->length = length;
   string->chars = chars;
   string->hash = hash;
+  string->interned = intern;
+  string->left = nullptr;
+  string->right = nullptr;
 
-  push(OBJ_VAL(string));
-  tableSet(&(vm.strings), string, NIL_VAL);
-  pop();
+  if (intern) {
+    push(OBJ_VAL(string));
+    tableSet(&(vm.strings), string, NIL_VAL);
+    pop();
+  }
 
   return string;
 }
 
-static uint32_t
+// String hashing is wyhash (final version 4): it consumes 8 bytes per read and mixes with 64x64->128 bit multiplies,
+// and its output is uniform enough in the low bits for power-of-two tables.
+
+static const uint64_t WYHASH_SECRET[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull,
+                                          0x4d5a2da51de1aa47ull};
+
+static inline void
+wyMultiply(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t product = (__uint128_t)*a * *b;
+  *a = (uint64_t)product;
+  *b = (uint64_t)(product >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t carry = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  carry += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+static inline uint64_t
+wyMix(uint64_t a, uint64_t b) {
+  wyMultiply(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t
+read64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t
+read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t
 hashString(const char* key, int length) {
-  uint32_t hash = 2166136261u;
-  for (int i = 0; i < length; i++) {
-    hash ^= (uint8_t)key[i];
-    hash *= 16777619;
+  const uint8_t* p = (const uint8_t*)key;
+  const uint64_t* secret = WYHASH_SECRET;
+  size_t len = (size_t)length;
+  uint64_t seed = wyMix(secret[0], secret[1]);
+  uint64_t a;
+  uint64_t b;
+
+  if (len <= 16) {
+    if (len >= 4) {
+      const size_t middle = (len >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + middle);
+      b = (read32(p + len - 4) << 32) | read32(p + len - 4 - middle);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = 0;
+      b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t see1 = seed;
+      uint64_t see2 = seed;
+      do {
+        seed = wyMix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+        see1 = wyMix(read64(p + 16) ^ secret[2], read64(p + 24) ^ see1);
+        see2 = wyMix(read64(p + 32) ^ secret[3], read64(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wyMix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
   }
-  return hash;
+
+  a ^= secret[1];
+  b ^= seed;
+  wyMultiply(&a, &b);
+  const uint64_t hash = wyMix(a ^ secret[0] ^ len, b ^ secret[1]);
+  return (uint32_t)(hash ^ (hash >> 32));
 }
 
 ObjString*
 takeString(char* chars, int length) {
-  uint32_t hash = hashString(chars, length);
-  ObjString* interned = tableFindString(&(vm.strings), chars, length, hash);
-  if (interned != nullptr) {
-    FREE_ARRAY(char, chars, length + 1);
-    return interned;
-  }
-  return allocateString(chars, length, hash);
+  // NOTE: strings built at run time are neither hashed nor interned until they are looked up or used as a table key
+  return allocateString(chars, length, 0, false);
 }
 
 ObjString*
@@ -151,7 +337,212 @@ copyString(const char* chars, int length) {
   char* heapChars = ALLOCATE(char, length + 1);
   memcpy(heapChars, chars, length);
   heapChars[length] = '\0';
-  return allocateString(heapChars, length, hash);
+  return allocateString(heapChars, length, hash, true);
+}
+
+/**
+ * The hash of `string`, flattening it and computing the hash the first time it is asked for.
+ */
+static uint32_t
+stringHash(ObjString* string) {
+  // NOTE: a string that really hashes to 0 is just hashed again every time
+  if (string->hash == 0) {
+    const char* chars = flattenString(string);
+    string->hash = hashString(chars, string->length);
+  }
+  return string->hash;
+}
+
+ObjString*
+findInternedString(ObjString* string) {
+  if (string->interned) {
+    return string;
+  }
+  const uint32_t hash = stringHash(string);
+  return tableFindString(&(vm.strings), string->chars, string->length, hash);
+}
+
+ObjString*
+internString(ObjString* string) {
+  if (string->interned) {
+    return string;
+  }
+
+  const uint32_t hash = stringHash(string);
+  ObjString* interned = tableFindString(&(vm.strings), string->chars, string->length, hash);
+  if (interned != nullptr) {
+    return interned;
+  }
+
+  string->interned = true;
+  push(OBJ_VAL(string));
+  tableSet(&(vm.strings), string, NIL_VAL);
+  pop();
+  return string;
+}
+
+ObjString*
+concatenateStrings(ObjString* a, ObjString* b) {
+  int length = a->length + b->length;
+  if (length < lims::ROPE_MIN_LENGTH && a->chars != nullptr && b->chars != nullptr) {
+    char* chars = ALLOCATE(char, length + 1);
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+    return takeString(chars, length);
+  }
+
+  ObjString* rope = ALLOCATE_OBJ(ObjString, ObjType::OBJ_STRING);
+  rope->length = length;
+  rope->chars = nullptr;
+  rope->hash = 0;
+  rope->interned = false;
+  rope->left = a;
+  rope->right = b;
+  return rope;
+}
+
+const char*
+flattenString(ObjString* string) {
+  if (string->chars != nullptr) {
+    return string->chars;
+  }
+
+  push(OBJ_VAL(string));
+  char* chars = ALLOCATE(char, string->length + 1);
+  chars[string->length] = '\0';
+
+  // Copy the pieces from the back; a rope grown by appending only ever has two of them pending.
+  try {
+    int end = string->length;
+    Vec<ObjString*> pending;
+    pending.push(string->left);
+    pending.push(string->right);
+    while (pending.count > 0) {
+      ObjString* part = pending.pop();
+      if (part->chars != nullptr) {
+        end -= part->length;
+        memcpy(chars + end, part->chars, part->length);
+      } else {
+        pending.push(part->left);
+        pending.push(part->right);
+      }
+    }
+  } catch (const OutOfMemory&) {
+    FREE_ARRAY(char, chars, string->length + 1);
+    throw;
+  }
+
+  string->chars = chars;
+  string->left = nullptr;
+  string->right = nullptr;
+  pop();
+  return chars;
+}
+
+bool
+stringsEqual(ObjString* a, ObjString* b) {
+  if (a == b) {
+    return true;
+  }
+  if ((a->interned && b->interned) || a->length != b->length) {
+    return false;
+  }
+  if (a->hash != 0 && b->hash != 0 && a->hash != b->hash) {
+    return false;
+  }
+
+  push(OBJ_VAL(a));
+  push(OBJ_VAL(b));
+  const bool equal = memcmp(flattenString(a), flattenString(b), a->length) == 0;
+  pop();
+  pop();
+  return equal;
+}
+
+// The lists and maps being printed, outermost first. A container met again while it is being printed is a cycle.
+static Obj* printing[lims::PRINT_DEPTH_MAX];
+static int printingCount = 0;
+
+/**
+ * Start printing the container `object`; false when it is already being printed or nested too deep, and only a
+ * placeholder should be printed.
+ */
+static bool
+enterPrint(Obj* object) {
+  if (printingCount == lims::PRINT_DEPTH_MAX) {
+    return false;
+  }
+  for (int i = 0; i < printingCount; i++) {
+    if (printing[i] == object) {
+      return false;
+    }
+  }
+  printing[printingCount++] = object;
+  return true;
+}
+
+static void
+leavePrint() {
+  printingCount -= 1;
+}
+
+void
+resetPrinting() {
+  printingCount = 0;
+}
+
+static void
+printList(ObjList* list) {
+  if (!enterPrint((Obj*)list)) {
+    printf("[...]");
+    return;
+  }
+  printf("[");
+  for (int i = 0; i < list->items.count; i++) {
+    if (i > 0) {
+      printf(", ");
+    }
+    printValue(list->items[i]);
+  }
+  printf("]");
+  leavePrint();
+}
+
+static void
+printFloat64Array(ObjFloat64Array* array) {
+  printf("Float64Array[");
+  for (int i = 0; i < array->length; i++) {
+    if (i > 0) {
+      printf(", ");
+    }
+    printf("%g", array->values[i]);
+  }
+  printf("]");
+}
+
+static void
+printMap(ObjMap* map) {
+  if (!enterPrint((Obj*)map)) {
+    printf("{...}");
+    return;
+  }
+  printf("{");
+  bool first = true;
+  for (int i = 0; i < map->entries.capacity; i++) {
+    if (map->entries.control[i] < 0) {
+      continue;
+    }
+    if (!first) {
+      printf(", ");
+    }
+    first = false;
+    printValue(map->entries.entries[i].key);
+    printf(": ");
+    printValue(map->entries.entries[i].value);
+  }
+  printf("}");
+  leavePrint();
 }
 
 static void
@@ -168,10 +559,38 @@ newUpvalue(Value* slot) {
   ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, ObjType::OBJ_UPVALUE);
   upvalue->closed = NIL_VAL;
   upvalue->location = slot;
-  upvalue->next = nullptr;
   return upvalue;
 }
 
+const char*
+objTypeName(ObjType type) {
+  switch (type) {
+  case ObjType::OBJ_BOUND_METHOD:
+    return "boundMethod";
+  case ObjType::OBJ_CLASS:
+    return "class";
+  case ObjType::OBJ_CLOSURE:
+    return "closure";
+  case ObjType::OBJ_FLOAT64_ARRAY:
+    return "float64Array";
+  case ObjType::OBJ_FUNCTION:
+    return "function";
+  case ObjType::OBJ_INSTANCE:
+    return "instance";
+  case ObjType::OBJ_LIST:
+    return "list";
+  case ObjType::OBJ_MAP:
+    return "map";
+  case ObjType::OBJ_NATIVE:
+    return "native";
+  case ObjType::OBJ_STRING:
+    return "string";
+  case ObjType::OBJ_UPVALUE:
+    return "upvalue";
+  }
+  return "unknown";
+}
+
 void
 printObject(Value value) {
   switch (OBJ_TYPE(value)) {
@@ -184,17 +603,26 @@ printObject(Value value) {
   case ObjType::OBJ_CLOSURE:
     printFunction(AS_CLOSURE(value)->function);
     break;
+  case ObjType::OBJ_FLOAT64_ARRAY:
+    printFloat64Array(AS_FLOAT64_ARRAY(value));
+    break;
   case ObjType::OBJ_FUNCTION:
     printFunction(AS_FUNCTION(value));
     break;
   case ObjType::OBJ_INSTANCE:
     printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
     break;
+  case ObjType::OBJ_LIST:
+    printList(AS_LIST(value));
+    break;
+  case ObjType::OBJ_MAP:
+    printMap(AS_MAP(value));
+    break;
   case ObjType::OBJ_NATIVE:
     printf("<native fn>");
     break;
   case ObjType::OBJ_STRING:
-    printf("%s", AS_CSTRING(value));
+    printf("%s", flattenString(AS_STRING(value)));
     break;
   case ObjType::OBJ_UPVALUE:
     printf("upvalue");
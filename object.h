@@ -3,41 +3,56 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "profile.h"
 #include "table.h"
 #include "value.h"
 
 // clang-format off
-#define OBJ_TYPE(value)        (AS_OBJ(value)->type)
-
-#define IS_BOUND_METHOD(value) isObjType(value, ObjType::OBJ_BOUND_METHOD)
-#define IS_CLASS(value)        isObjType(value, ObjType::OBJ_CLASS)
-#define IS_CLOSURE(value)      isObjType(value, ObjType::OBJ_CLOSURE)
-#define IS_FUNCTION(value)     isObjType(value, ObjType::OBJ_FUNCTION)
-#define IS_INSTANCE(value)     isObjType(value, ObjType::OBJ_INSTANCE)
-#define IS_NATIVE(value)       isObjType(value, ObjType::OBJ_NATIVE)
-#define IS_STRING(value)       isObjType(value, ObjType::OBJ_STRING)
-
-#define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
-#define AS_CLASS(value)        ((ObjClass*)AS_OBJ(value))
-#define AS_CLOSURE(value)      ((ObjClosure*)AS_OBJ(value))
-#define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))
-#define AS_INSTANCE(value)     ((ObjInstance*)AS_OBJ(value))
-#define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->function)
-#define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
+#define OBJ_TYPE(value)         (AS_OBJ(value)->type)
+
+#define IS_BOUND_METHOD(value)  isObjType(value, ObjType::OBJ_BOUND_METHOD)
+#define IS_CLASS(value)         isObjType(value, ObjType::OBJ_CLASS)
+#define IS_CLOSURE(value)       isObjType(value, ObjType::OBJ_CLOSURE)
+#define IS_FLOAT64_ARRAY(value) isObjType(value, ObjType::OBJ_FLOAT64_ARRAY)
+#define IS_FUNCTION(value)      isObjType(value, ObjType::OBJ_FUNCTION)
+#define IS_INSTANCE(value)      isObjType(value, ObjType::OBJ_INSTANCE)
+#define IS_LIST(value)          isObjType(value, ObjType::OBJ_LIST)
+#define IS_MAP(value)           isObjType(value, ObjType::OBJ_MAP)
+#define IS_NATIVE(value)        isObjType(value, ObjType::OBJ_NATIVE)
+#define IS_STRING(value)        isObjType(value, ObjType::OBJ_STRING)
+
+#define AS_BOUND_METHOD(value)  ((ObjBoundMethod*)AS_OBJ(value))
+#define AS_CLASS(value)         ((ObjClass*)AS_OBJ(value))
+#define AS_CLOSURE(value)       ((ObjClosure*)AS_OBJ(value))
+#define AS_FLOAT64_ARRAY(value) ((ObjFloat64Array*)AS_OBJ(value))
+#define AS_FUNCTION(value)      ((ObjFunction*)AS_OBJ(value))
+#define AS_INSTANCE(value)      ((ObjInstance*)AS_OBJ(value))
+#define AS_LIST(value)          ((ObjList*)AS_OBJ(value))
+#define AS_MAP(value)           ((ObjMap*)AS_OBJ(value))
+#define AS_NATIVE(value)        ((ObjNative*)AS_OBJ(value))
+#define AS_STRING(value)        ((ObjString*)AS_OBJ(value))
+#define AS_CSTRING(value)       (((ObjString*)AS_OBJ(value))->chars)
 // clang-format on
 
 enum class ObjType {
   OBJ_BOUND_METHOD,
   OBJ_CLASS,
   OBJ_CLOSURE,
+  OBJ_FLOAT64_ARRAY,
   OBJ_FUNCTION,
   OBJ_INSTANCE,
+  OBJ_LIST,
+  OBJ_MAP,
   OBJ_NATIVE,
   OBJ_STRING,
   OBJ_UPVALUE,
 };
 
+constexpr int OBJ_TYPE_COUNT = (int)ObjType::OBJ_UPVALUE + 1;
+
+const char*
+objTypeName(ObjType type);
+
 class Obj {
 public:
   explicit
@@ -46,18 +61,20 @@ public:
   // virtual void
   // gcMark() = 0;
 
-  ObjType type;
-  bool isMarked;
-  Obj* next;
+  ObjType type; // the mark bit and the heap's bookkeeping live in the page header, see heap.h
 };
 
 class ObjFunction : Obj {
 public:
   ObjFunction();
+  ~ObjFunction();
 
   void
   gcMark();
 
+  void
+  gcRelocate();
+
   void*
   operator new(size_t size);
   void
@@ -67,27 +84,78 @@ public:
   int upvalueCount;
   Chunk chunk;
   ObjString* name; // owned
+
+  // A copy of the parameter list and body still to be compiled on the first call, nullptr once `chunk` holds the code.
+  // It is copied because the source may be closed before then.
+  char* bodySource;
+  int bodyLength;
+  int bodyLine;
+  bool bodyIsMethod;
+
+#ifdef DEBUG_PROFILE
+  FunctionProfile* profile; // nullptr until the function first runs
+#endif
+};
+
+/**
+ * A growable array of values, built by list literals and indexed with `[]`.
+ */
+class ObjList : Obj {
+public:
+  ObjList();
+
+  void
+  gcMark();
+
+  void
+  gcRelocate();
+
+  void*
+  operator new(size_t size);
+  void
+  operator delete(void* ptr);
+
+  Vec<Value> items;
 };
 
-typedef Value (*NativeFn)(int argCount, Value* args);
+/**
+ * A native function gets its `argCount` arguments in `args`; a native method gets its receiver in args[0], before them.
+ * It stores its result in `*result` and returns true, or returns false after nativeError(). `*result` is a slot on the
+ * stack, nil to start with: an object stored there stays reachable while the native allocates more.
+ */
+typedef bool (*NativeFn)(int argCount, Value* args, Value* result);
+
+constexpr int NATIVE_VARIADIC = -1;
 
 struct ObjNative {
   Obj obj;
   NativeFn function;
+  // The number of arguments a call must pass, not counting a method's receiver; the VM checks it before the call.
+  int minArity;
+  int maxArity; // or NATIVE_VARIADIC
 };
 
+/**
+ * A string is either flat, with `chars` holding the text, or a rope: the concatenation of `left` and `right`, built by
+ * `+` without copying either side. flattenString() turns a rope into a flat string in place. Only interned strings
+ * are unique by content. Names and literals are interned when they are compiled; strings built at run time stay
+ * uninterned until internString() is asked for them, which the tables do when one is used as a key. `hash` is 0 until
+ * the string is first looked up, and then kept.
+ */
 struct ObjString {
   Obj obj;
   int length;
-  char* chars;
+  char* chars; // nullptr while a rope
   uint32_t hash;
+  bool interned;
+  ObjString* left;
+  ObjString* right;
 };
 
 struct ObjUpvalue {
   Obj obj;
   Value* location;
   Value closed;
-  ObjUpvalue* next;
 };
 
 struct ObjClosure {
@@ -100,7 +168,11 @@ struct ObjClosure {
 struct ObjClass {
   Obj obj;
   ObjString* name;
+  ObjClass* superclass; // nullptr for none
   Table methods;
+  // `methods` is the superclass's table, shared until the class defines a method of its own. A class's body has run
+  // before it can be a superclass, so the table no longer changes.
+  bool sharesMethods;
 };
 
 struct ObjInstance {
@@ -109,6 +181,20 @@ struct ObjInstance {
   Table fields;
 };
 
+/**
+ * A fixed-length array of unboxed doubles, for the bulk kernels in numeric.h.
+ */
+struct ObjFloat64Array {
+  Obj obj;
+  int length;
+  double* values;
+};
+
+struct ObjMap {
+  Obj obj;
+  ValueTable entries;
+};
+
 struct ObjBoundMethod {
   Obj obj;
   Value receiver;
@@ -124,14 +210,26 @@ newClass(ObjString* name);
 ObjClosure*
 newClosure(ObjFunction* function);
 
+ObjFloat64Array*
+newFloat64Array(int length);
+
 ObjFunction*
 newFunction();
 
 ObjInstance*
 newInstance(ObjClass* klass);
 
+ObjList*
+newList();
+
+ObjMap*
+newMap();
+
 ObjNative*
-newNative(NativeFn function);
+newNative(NativeFn function, int minArity, int maxArity);
+
+uint32_t
+hashString(const char* key, int length);
 
 ObjString*
 takeString(char* chars, int length);
@@ -139,12 +237,39 @@ takeString(char* chars, int length);
 ObjString*
 copyString(const char* chars, int length);
 
+/**
+ * The interned string with the same characters as `string`, or nullptr if there is none.
+ */
+ObjString*
+findInternedString(ObjString* string);
+
+/**
+ * The interned string with the same characters as `string`; interns `string` itself if there is none yet.
+ */
+ObjString*
+internString(ObjString* string);
+
+ObjString*
+concatenateStrings(ObjString* a, ObjString* b);
+
+const char*
+flattenString(ObjString* string);
+
+bool
+stringsEqual(ObjString* a, ObjString* b);
+
 ObjUpvalue*
 newUpvalue(Value* slot);
 
 void
 printObject(Value value);
 
+/**
+ * Forget the containers being printed, after an OutOfMemory cut printing short.
+ */
+void
+resetPrinting();
+
 static inline bool
 isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -0,0 +1,231 @@
+#include "profile.h"
+
+#ifdef DEBUG_PROFILE
+
+#include "debug.h"
+#include "object.h"
+#include "vm.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// NOTE: everything here allocates with malloc, not reallocate(): counters are folded while the collector sweeps.
+
+#define PROFILE_TOP_LINES 20
+
+struct OpCounter {
+  uint64_t count;
+  uint64_t cycles;
+};
+
+struct LineCounter {
+  const char* function;
+  int line;
+  uint64_t count;
+  uint64_t cycles;
+};
+
+static OpCounter opCounters[256];
+
+static LineCounter* lineCounters = nullptr;
+static int lineCount = 0;
+static int lineCapacity = 0;
+
+static ObjFunction* lastFunction = nullptr;
+static int lastOffset = 0;
+static uint64_t lastStart = 0;
+
+static inline uint64_t
+readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+static FunctionProfile*
+profileOf(ObjFunction* function) {
+  if (function->profile != nullptr) {
+    return function->profile;
+  }
+
+  const char* name = function->name == nullptr ? "script" : function->name->chars;
+  const int codeCount = function->chunk.getCount();
+  FunctionProfile* profile = (FunctionProfile*)malloc(sizeof(FunctionProfile));
+  profile->name = strdup(name);
+  profile->codeCount = codeCount;
+  profile->counts = (uint64_t*)calloc(codeCount, sizeof(uint64_t));
+  profile->cycles = (uint64_t*)calloc(codeCount, sizeof(uint64_t));
+  if (profile->name == nullptr || profile->counts == nullptr || profile->cycles == nullptr) {
+    exit(1);
+  }
+
+  function->profile = profile;
+  return profile;
+}
+
+static void
+chargeLast(uint64_t now) {
+  if (lastFunction == nullptr) {
+    return;
+  }
+
+  const uint64_t elapsed = now - lastStart;
+  OpCounter* op = &(opCounters[lastFunction->chunk.code[lastOffset]]);
+  op->count += 1;
+  op->cycles += elapsed;
+
+  FunctionProfile* profile = profileOf(lastFunction);
+  profile->counts[lastOffset] += 1;
+  profile->cycles[lastOffset] += elapsed;
+}
+
+void
+profileInstruction(ObjFunction* function, int offset) {
+  const uint64_t now = readCycles();
+  chargeLast(now);
+  lastFunction = function;
+  lastOffset = offset;
+  lastStart = now;
+}
+
+void
+profileStop() {
+  chargeLast(readCycles());
+  lastFunction = nullptr;
+}
+
+static void
+addLine(const char* function, int line, uint64_t count, uint64_t cycles) {
+  for (int i = 0; i < lineCount; i++) {
+    LineCounter* counter = &(lineCounters[i]);
+    if (counter->line == line && strcmp(counter->function, function) == 0) {
+      counter->count += count;
+      counter->cycles += cycles;
+      return;
+    }
+  }
+
+  if (lineCount == lineCapacity) {
+    lineCapacity = lineCapacity < 64 ? 64 : lineCapacity * 2;
+    lineCounters = (LineCounter*)realloc(lineCounters, sizeof(LineCounter) * lineCapacity);
+    if (lineCounters == nullptr) {
+      exit(1);
+    }
+  }
+  lineCounters[lineCount++] = LineCounter{strdup(function), line, count, cycles};
+}
+
+void
+profileFunctionFreed(ObjFunction* function) {
+  FunctionProfile* profile = function->profile;
+  if (profile == nullptr) {
+    return;
+  }
+
+  for (int offset = 0; offset < profile->codeCount; offset++) {
+    if (profile->counts[offset] > 0) {
+      addLine(profile->name, function->chunk.getLine(offset), profile->counts[offset], profile->cycles[offset]);
+    }
+  }
+
+  free(profile->name);
+  free(profile->counts);
+  free(profile->cycles);
+  free(profile);
+  function->profile = nullptr;
+}
+
+static int
+compareLines(const void* a, const void* b) {
+  const uint64_t cyclesA = ((const LineCounter*)a)->cycles;
+  const uint64_t cyclesB = ((const LineCounter*)b)->cycles;
+  return cyclesA < cyclesB ? 1 : (cyclesA > cyclesB ? -1 : 0);
+}
+
+static double
+share(uint64_t cycles, uint64_t total) {
+  return total == 0 ? 0 : 100.0 * (double)cycles / (double)total;
+}
+
+static void
+foldFunction(Obj* object, void* context) {
+  if (object->type == ObjType::OBJ_FUNCTION) {
+    profileFunctionFreed((ObjFunction*)object);
+  }
+}
+
+void
+profileReport(FILE* out) {
+  // Move the counters of the functions that are still alive into the line totals first.
+  finishSweep();
+  heapEach(&(vm.heap), foldFunction, nullptr);
+
+  uint64_t total = 0;
+  int opOrder[256];
+  int opCount = 0;
+  for (int op = 0; op < 256; op++) {
+    if (opCounters[op].count > 0) {
+      total += opCounters[op].cycles;
+      opOrder[opCount++] = op;
+    }
+  }
+  for (int i = 1; i < opCount; i++) { // NOTE: insertion sort, there are only a few dozen opcodes
+    const int op = opOrder[i];
+    int j = i;
+    for (; j > 0 && opCounters[opOrder[j - 1]].cycles < opCounters[op].cycles; j--) {
+      opOrder[j] = opOrder[j - 1];
+    }
+    opOrder[j] = op;
+  }
+
+  fprintf(out, "== profile: opcodes ==\n");
+  fprintf(out, "%-18s %14s %16s %10s %7s\n", "opcode", "count", "cycles", "cycles/op", "share");
+  for (int i = 0; i < opCount; i++) {
+    const OpCounter* counter = &(opCounters[opOrder[i]]);
+    fprintf(out, "%-18s %14llu %16llu %10.1f %6.2f%%\n", opCodeName(u8ToOpCode((uint8_t)opOrder[i])),
+            (unsigned long long)counter->count, (unsigned long long)counter->cycles,
+            (double)counter->cycles / (double)counter->count, share(counter->cycles, total));
+  }
+
+  // Functions are totals over their lines, so they are told apart by name only.
+  LineCounter* functions = (LineCounter*)malloc(sizeof(LineCounter) * (lineCount > 0 ? lineCount : 1));
+  int functionCount = 0;
+  for (int i = 0; i < lineCount; i++) {
+    int j = 0;
+    while (j < functionCount && strcmp(functions[j].function, lineCounters[i].function) != 0) {
+      j++;
+    }
+    if (j == functionCount) {
+      functions[functionCount++] = LineCounter{lineCounters[i].function, 0, 0, 0};
+    }
+    functions[j].count += lineCounters[i].count;
+    functions[j].cycles += lineCounters[i].cycles;
+  }
+  qsort(functions, functionCount, sizeof(LineCounter), compareLines);
+
+  fprintf(out, "== profile: functions ==\n");
+  fprintf(out, "%-24s %14s %16s %7s\n", "function", "instructions", "cycles", "share");
+  for (int i = 0; i < functionCount; i++) {
+    fprintf(out, "%-24s %14llu %16llu %6.2f%%\n", functions[i].function, (unsigned long long)functions[i].count,
+            (unsigned long long)functions[i].cycles, share(functions[i].cycles, total));
+  }
+  free(functions);
+
+  qsort(lineCounters, lineCount, sizeof(LineCounter), compareLines);
+  fprintf(out, "== profile: lines (top %d) ==\n", PROFILE_TOP_LINES);
+  fprintf(out, "%-24s %6s %14s %16s %7s\n", "function", "line", "instructions", "cycles", "share");
+  for (int i = 0; i < lineCount && i < PROFILE_TOP_LINES; i++) {
+    const LineCounter* counter = &(lineCounters[i]);
+    fprintf(out, "%-24s %6d %14llu %16llu %6.2f%%\n", counter->function, counter->line,
+            (unsigned long long)counter->count, (unsigned long long)counter->cycles, share(counter->cycles, total));
+  }
+}
+
+#endif
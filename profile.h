@@ -0,0 +1,44 @@
+#ifndef CLOX_PROFILE_H
+#define CLOX_PROFILE_H
+
+#include "common.h"
+
+#include <cstdio>
+
+// The execution profiler, compiled in with DEBUG_PROFILE. run() reports every instruction it is about to execute; the
+// time until the next report is charged to that instruction's opcode, and to its function and source line.
+
+class ObjFunction;
+
+/**
+ * Per-instruction counters of one function, indexed by bytecode offset.
+ */
+struct FunctionProfile {
+  char* name; // copied, the function's name may be collected first
+  int codeCount;
+  uint64_t* counts;
+  uint64_t* cycles;
+};
+
+void
+profileInstruction(ObjFunction* function, int offset);
+
+/**
+ * Charge the last instruction; called when run() returns.
+ */
+void
+profileStop();
+
+/**
+ * Fold the counters of a function into the per-line totals and release them.
+ */
+void
+profileFunctionFreed(ObjFunction* function);
+
+/**
+ * Print opcode, function and line tables, each sorted by cycles.
+ */
+void
+profileReport(FILE* out);
+
+#endif
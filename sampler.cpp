@@ -0,0 +1,226 @@
+#include "sampler.h"
+
+#include "object.h"
+#include "vm.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SAMPLER_USE_SIGPROF
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+// NOTE: like the profiler this allocates with malloc: drainSamples() runs at the start of a collection.
+
+#define SAMPLE_RING_SIZE 1024
+#define SAMPLE_STACK_MAX (lims::FRAMES_MAX * 64)
+
+std::atomic<bool> samplerBacklog{false};
+
+struct SampledFrame {
+  ObjFunction* function;
+  int offset;
+};
+
+struct Sample {
+  int depth;
+  SampledFrame frames[lims::FRAMES_MAX];
+};
+
+// Single producer (the handler), single consumer (drainSamples()); both run on the interpreter's thread.
+static Sample ring[SAMPLE_RING_SIZE];
+static std::atomic<uint32_t> ringHead{0};
+static std::atomic<uint32_t> ringTail{0};
+static std::atomic<uint32_t> droppedSamples{0};
+
+struct StackCount {
+  char* stack; // nullptr in an empty slot
+  uint32_t hash;
+  uint64_t count;
+};
+
+static StackCount* stacks = nullptr;
+static int stackCount = 0;
+static int stackCapacity = 0;
+
+static char* outputPath = nullptr;
+
+#ifdef SAMPLER_USE_SIGPROF
+
+static void
+takeSample(int signal) {
+  const uint32_t head = ringHead.load(std::memory_order_relaxed);
+  const uint32_t tail = ringTail.load(std::memory_order_acquire);
+  if (head - tail >= SAMPLE_RING_SIZE) {
+    droppedSamples.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // call() fills a frame in before counting it, so every counted frame is complete.
+  Sample* sample = &(ring[head % SAMPLE_RING_SIZE]);
+  const int depth = vm.frames.count;
+  for (int i = 0; i < depth; i++) {
+    const CallFrame* frame = &(vm.frames.items[i]);
+    ObjFunction* function = frame->closure->function;
+    const int offset = (int)(frame->ip - function->chunk.code.beginning()) - 1;
+    sample->frames[i] = SampledFrame{function, offset < 0 ? 0 : offset};
+  }
+  sample->depth = depth;
+
+  ringHead.store(head + 1, std::memory_order_release);
+  if (head + 1 - tail >= SAMPLE_RING_SIZE / 2) {
+    samplerBacklog.store(true, std::memory_order_relaxed);
+  }
+}
+
+static bool
+setTimer(int intervalMicros) {
+  struct itimerval timer;
+  timer.it_interval.tv_sec = intervalMicros / 1000000;
+  timer.it_interval.tv_usec = intervalMicros % 1000000;
+  timer.it_value = timer.it_interval;
+  return setitimer(ITIMER_PROF, &timer, nullptr) == 0;
+}
+
+#endif
+
+static void
+growStacks() {
+  const int oldCapacity = stackCapacity;
+  StackCount* oldStacks = stacks;
+
+  stackCapacity = oldCapacity == 0 ? 256 : oldCapacity * 2;
+  stacks = (StackCount*)calloc(stackCapacity, sizeof(StackCount));
+  if (stacks == nullptr) {
+    exit(1);
+  }
+
+  for (int i = 0; i < oldCapacity; i++) {
+    if (oldStacks[i].stack == nullptr) {
+      continue;
+    }
+    uint32_t index = modulo(oldStacks[i].hash, stackCapacity);
+    while (stacks[index].stack != nullptr) {
+      index = modulo(index + 1, stackCapacity);
+    }
+    stacks[index] = oldStacks[i];
+  }
+  free(oldStacks);
+}
+
+static void
+countStack(const char* stack, int length) {
+  if (stackCount + 1 > stackCapacity * 3 / 4) {
+    growStacks();
+  }
+
+  const uint32_t hash = hashString(stack, length);
+  uint32_t index = modulo(hash, stackCapacity);
+  while (stacks[index].stack != nullptr) {
+    if (stacks[index].hash == hash && strcmp(stacks[index].stack, stack) == 0) {
+      stacks[index].count += 1;
+      return;
+    }
+    index = modulo(index + 1, stackCapacity);
+  }
+
+  stacks[index] = StackCount{strdup(stack), hash, 1};
+  stackCount += 1;
+}
+
+void
+drainSamples() {
+  const uint32_t head = ringHead.load(std::memory_order_acquire);
+  uint32_t tail = ringTail.load(std::memory_order_relaxed);
+  if (head == tail) {
+    return;
+  }
+
+  char stack[SAMPLE_STACK_MAX];
+  for (; tail != head; tail++) {
+    const Sample* sample = &(ring[tail % SAMPLE_RING_SIZE]);
+    int length = 0;
+    if (sample->depth == 0) {
+      length = snprintf(stack, sizeof(stack), "(outside script)");
+    }
+    for (int i = 0; i < sample->depth && length < (int)sizeof(stack); i++) {
+      ObjFunction* function = sample->frames[i].function;
+      const char* name = function->name == nullptr ? "script" : function->name->chars;
+      length += snprintf(stack + length, sizeof(stack) - length, "%s%s:%d", i == 0 ? "" : ";", name,
+                         function->chunk.getLine(sample->frames[i].offset));
+    }
+    if (length >= (int)sizeof(stack)) {
+      length = (int)sizeof(stack) - 1;
+    }
+    countStack(stack, length);
+  }
+
+  ringTail.store(tail, std::memory_order_release);
+  samplerBacklog.store(false, std::memory_order_relaxed);
+}
+
+#ifdef SAMPLER_USE_SIGPROF
+
+bool
+startSampling(const char* path, int intervalMicros) {
+  outputPath = strdup(path);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = takeSample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  return outputPath != nullptr && sigaction(SIGPROF, &action, nullptr) == 0 && setTimer(intervalMicros);
+}
+
+void
+stopSampling() {
+  if (outputPath == nullptr) {
+    return;
+  }
+  setTimer(0);
+  signal(SIGPROF, SIG_IGN);
+  drainSamples();
+
+  FILE* file = fopen(outputPath, "w");
+  if (file == nullptr) {
+    fprintf(stderr, "Could not write samples to \"%s\".\n", outputPath);
+  } else {
+    for (int i = 0; i < stackCapacity; i++) {
+      if (stacks[i].stack != nullptr) {
+        fprintf(file, "%s %llu\n", stacks[i].stack, (unsigned long long)stacks[i].count);
+      }
+    }
+    fclose(file);
+  }
+
+  const uint32_t dropped = droppedSamples.load(std::memory_order_relaxed);
+  if (dropped > 0) {
+    fprintf(stderr, "Sampler dropped %u samples.\n", dropped);
+  }
+
+  for (int i = 0; i < stackCapacity; i++) {
+    free(stacks[i].stack);
+  }
+  free(stacks);
+  stacks = nullptr;
+  stackCount = 0;
+  stackCapacity = 0;
+  free(outputPath);
+  outputPath = nullptr;
+}
+
+#else
+
+bool
+startSampling(const char* path, int intervalMicros) {
+  return false;
+}
+
+void
+stopSampling() {}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef CLOX_SAMPLER_H
+#define CLOX_SAMPLER_H
+
+#include <atomic>
+
+// The sampling profiler. A SIGPROF timer interrupts the interpreter and the handler copies the function and bytecode
+// offset of every frame in vm.frames into a ring buffer. Samples are turned into "script:3;outer:7;inner:12" stacks
+// outside the handler, at the latest before the collector could free a function they point to, and are written in the
+// folded format that flame graph tools read.
+
+extern std::atomic<bool> samplerBacklog;
+
+/**
+ * Start sampling every `intervalMicros` of CPU time; the folded stacks go to `path` when sampling stops.
+ */
+bool
+startSampling(const char* path, int intervalMicros);
+
+void
+stopSampling();
+
+/**
+ * Turn the samples in the ring buffer into stacks. Must not be called from the signal handler.
+ */
+void
+drainSamples();
+
+/**
+ * True once the ring buffer is half full; cheap enough to test on every call and loop iteration.
+ */
+inline bool
+samplerBacklogged() {
+  return samplerBacklog.load(std::memory_order_relaxed);
+}
+
+#endif
@@ -1,21 +1,94 @@
 #include "scanner.h"
 
+#include "source.h"
+
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 struct Scanner {
   const char* start;
   const char* current;
   int line;
+  Source* source; // only set when the text may still grow
 };
 
 Scanner scanner;
 
+struct Keyword {
+  const char* chars;
+  int length;
+  TokenType type;
+};
+
+static const Keyword keywords[] = {
+    {"and", 3, TokenType::TOKEN_AND},
+    {"class", 5, TokenType::TOKEN_CLASS},
+    {"else", 4, TokenType::TOKEN_ELSE},
+    {"false", 5, TokenType::TOKEN_FALSE},
+    {"for", 3, TokenType::TOKEN_FOR},
+    {"fun", 3, TokenType::TOKEN_FUN},
+    {"if", 2, TokenType::TOKEN_IF},
+    {"nil", 3, TokenType::TOKEN_NIL},
+    {"or", 2, TokenType::TOKEN_OR},
+    {"print", 5, TokenType::TOKEN_PRINT},
+    {"return", 6, TokenType::TOKEN_RETURN},
+    {"super", 5, TokenType::TOKEN_SUPER},
+    {"this", 4, TokenType::TOKEN_THIS},
+    {"true", 4, TokenType::TOKEN_TRUE},
+    {"var", 3, TokenType::TOKEN_VAR},
+    {"while", 5, TokenType::TOKEN_WHILE},
+};
+
+constexpr int KEYWORD_MIN_LENGTH = 2;
+constexpr int KEYWORD_MAX_LENGTH = 6;
+constexpr int KEYWORD_TABLE_SIZE = 32;
+
+/**
+ * Perfect hash over the keyword set: no two keywords share a slot, so a lookup is one hash and one memcmp.
+ */
+static uint32_t
+keywordHash(const char* chars, int length) {
+  return ((uint8_t)chars[0] * 3u + (uint8_t)chars[1] + (uint32_t)length * 20u) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+static Keyword keywordTable[KEYWORD_TABLE_SIZE];
+
+static void
+initKeywordTable() {
+  if (keywordTable[keywordHash("and", 3)].chars != nullptr) {
+    return;
+  }
+  for (const Keyword& keyword : keywords) {
+    keywordTable[keywordHash(keyword.chars, keyword.length)] = keyword;
+  }
+}
+
 void
 initScanner(const char* source) {
+  initKeywordTable();
   scanner.start = source;
   scanner.current = source;
   scanner.line = 1;
+  scanner.source = nullptr;
+}
+
+void
+initScanner(const char* source, int line) {
+  initScanner(source);
+  scanner.line = line;
+}
+
+void
+initScanner(Source* source) {
+  initScanner(source->chars);
+  if (source->kind == SourceKind::SOURCE_STREAM) {
+    scanner.source = source;
+  }
 }
 
 static bool
@@ -28,9 +101,32 @@ isDigit(char c) {
   return c >= '0' && c <= '9';
 }
 
+/**
+ * A '\0' is the end of the source, unless it is the end of what has been read from a stream so far and the stream
+ * delivers more.
+ */
+static bool
+isEndOfSource(const char* at) {
+  while (*at == '\0') {
+    Source* source = scanner.source;
+    if (source == nullptr || at != source->chars + source->length || !refillSource(source)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 static bool
 isAtEnd() {
-  return *(scanner.current) == '\0';
+  return isEndOfSource(scanner.current);
+}
+
+/**
+ * True when a bulk scan stopped at the end of the text read so far and more has arrived, so it should resume.
+ */
+static bool
+refilledAtCurrent() {
+  return *(scanner.current) == '\0' && !isAtEnd();
 }
 
 static char
@@ -46,7 +142,7 @@ peek() {
 
 static char
 peekNext() {
-  if (isAtEnd()) {
+  if (isAtEnd() || isEndOfSource(scanner.current + 1)) {
     return '\0';
   }
   return scanner.current[1];
@@ -62,6 +158,160 @@ match(char expected) {
   return true;
 }
 
+#ifdef __SSE2__
+
+// The bulk scanners below read whole 16-byte aligned blocks. An aligned block never straddles a page, and every
+// character class stops at the terminating NUL, so they never touch memory past the block holding the end of source.
+// AddressSanitizer can't tell that tail read from a real overflow, hence no_sanitize_address on scanBlocks().
+
+constexpr uintptr_t BLOCK_SIZE = 16;
+
+static inline __m128i
+bytesEqual(__m128i block, char c) {
+  return _mm_cmpeq_epi8(block, _mm_set1_epi8(c));
+}
+
+static inline __m128i
+bytesInRange(__m128i block, char low, char high) {
+  return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8((char)(low - 1))),
+                       _mm_cmpgt_epi8(_mm_set1_epi8((char)(high + 1)), block));
+}
+
+static inline __m128i
+stopAtNonBlank(__m128i block) {
+  __m128i blank = _mm_or_si128(_mm_or_si128(bytesEqual(block, ' '), bytesEqual(block, '\t')),
+                               _mm_or_si128(bytesEqual(block, '\r'), bytesEqual(block, '\n')));
+  return _mm_xor_si128(blank, _mm_set1_epi8(-1));
+}
+
+static inline __m128i
+stopAtLineEnd(__m128i block) {
+  return _mm_or_si128(bytesEqual(block, '\n'), bytesEqual(block, '\0'));
+}
+
+static inline __m128i
+stopAtNonIdentifier(__m128i block) {
+  __m128i letter = bytesInRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z'); // NOTE: fold to lower case
+  __m128i word = _mm_or_si128(_mm_or_si128(letter, bytesInRange(block, '0', '9')), bytesEqual(block, '_'));
+  return _mm_xor_si128(word, _mm_set1_epi8(-1));
+}
+
+static inline __m128i
+stopAtNonDigit(__m128i block) {
+  return _mm_xor_si128(bytesInRange(block, '0', '9'), _mm_set1_epi8(-1));
+}
+
+static inline __m128i
+stopAtQuote(__m128i block) {
+  return _mm_or_si128(bytesEqual(block, '"'), bytesEqual(block, '\0'));
+}
+
+/**
+ * Return the first byte at or after `from` that `stopBytes` selects, adding the newlines skipped on the way to `line`
+ * when it is given.
+ */
+template <__m128i (*stopBytes)(__m128i)>
+__attribute__((no_sanitize_address)) static const char*
+scanBlocks(const char* from, int* line) {
+  const char* block = (const char*)((uintptr_t)from & ~(BLOCK_SIZE - 1));
+  uint32_t inRange = 0xffffu << (from - block);
+
+  for (;;) {
+    __m128i bytes = _mm_load_si128((const __m128i*)block);
+    uint32_t stop = (uint32_t)_mm_movemask_epi8(stopBytes(bytes)) & inRange;
+    uint32_t newlines = line != nullptr ? (uint32_t)_mm_movemask_epi8(bytesEqual(bytes, '\n')) & inRange : 0;
+
+    if (stop != 0) {
+      const int at = __builtin_ctz(stop);
+      if (line != nullptr) {
+        *line += __builtin_popcount(newlines & ((1u << at) - 1));
+      }
+      return block + at;
+    }
+
+    if (line != nullptr) {
+      *line += __builtin_popcount(newlines);
+    }
+    block += BLOCK_SIZE;
+    inRange = 0xffffu;
+  }
+}
+
+static const char*
+skipBlanks(const char* from, int* line) {
+  return scanBlocks<stopAtNonBlank>(from, line);
+}
+
+static const char*
+findLineEnd(const char* from) {
+  return scanBlocks<stopAtLineEnd>(from, nullptr);
+}
+
+static const char*
+skipIdentifierChars(const char* from) {
+  return scanBlocks<stopAtNonIdentifier>(from, nullptr);
+}
+
+static const char*
+skipDigits(const char* from) {
+  return scanBlocks<stopAtNonDigit>(from, nullptr);
+}
+
+static const char*
+findStringEnd(const char* from, int* line) {
+  return scanBlocks<stopAtQuote>(from, line);
+}
+
+#else
+
+static const char*
+skipBlanks(const char* from, int* line) {
+  for (;; from++) {
+    if (*from == '\n') {
+      *line += 1;
+    } else if (*from != ' ' && *from != '\r' && *from != '\t') {
+      return from;
+    }
+  }
+}
+
+static const char*
+findLineEnd(const char* from) {
+  while (*from != '\n' && *from != '\0') {
+    from++;
+  }
+  return from;
+}
+
+static const char*
+skipIdentifierChars(const char* from) {
+  while (isAlpha(*from) || isDigit(*from)) {
+    from++;
+  }
+  return from;
+}
+
+static const char*
+skipDigits(const char* from) {
+  while (isDigit(*from)) {
+    from++;
+  }
+  return from;
+}
+
+static const char*
+findStringEnd(const char* from, int* line) {
+  while (*from != '"' && *from != '\0') {
+    if (*from == '\n') {
+      *line += 1;
+    }
+    from++;
+  }
+  return from;
+}
+
+#endif
+
 static Token
 makeToken(TokenType type) {
   Token token{};
@@ -85,93 +335,31 @@ errorToken(const char* message) {
 static void
 skipWhitespace() {
   for (;;) {
-    char c = peek();
-    switch (c) {
-    case ' ':
-    case '\r':
-    case '\t': {
-      advance();
-      break;
-    }
-    case '\n': {
-      scanner.line++;
-      advance();
-      break;
-    }
-    case '/': {
-      if (peekNext() == '/') {
-        // A comment goes until the end of the line.
-        while (peek() != '\n' && !isAtEnd()) {
-          advance();
-        }
-      } else {
-        return;
-      }
-      break;
-    }
-    default:
+    do {
+      scanner.current = skipBlanks(scanner.current, &scanner.line);
+    } while (refilledAtCurrent());
+
+    if (peek() == '/' && peekNext() == '/') {
+      // A comment goes until the end of the line.
+      do {
+        scanner.current = findLineEnd(scanner.current);
+      } while (refilledAtCurrent());
+    } else {
       return;
     }
   }
 }
 
-static TokenType
-checkKeyword(int start, int length, const char* rest, TokenType type) {
-  if (scanner.current - scanner.start == start + length && memcmp(scanner.start + start, rest, length) == 0) {
-    return type;
-  }
-
-  return TokenType::TOKEN_IDENTIFIER;
-}
-
 static TokenType
 identifierType() {
-  switch (scanner.start[0]) {
-  case 'a':
-    return checkKeyword(1, 2, "nd", TokenType::TOKEN_AND);
-  case 'c':
-    return checkKeyword(1, 4, "lass", TokenType::TOKEN_CLASS);
-  case 'e':
-    return checkKeyword(1, 3, "lse", TokenType::TOKEN_ELSE);
-  case 'f': {
-    if (scanner.current - scanner.start > 1) {
-      switch (scanner.start[1]) {
-      case 'a':
-        return checkKeyword(2, 3, "lse", TokenType::TOKEN_FALSE);
-      case 'o':
-        return checkKeyword(2, 1, "r", TokenType::TOKEN_FOR);
-      case 'u':
-        return checkKeyword(2, 1, "n", TokenType::TOKEN_FUN);
-      }
-    }
-  }
-  case 'i':
-    return checkKeyword(1, 1, "f", TokenType::TOKEN_IF);
-  case 'n':
-    return checkKeyword(1, 2, "il", TokenType::TOKEN_NIL);
-  case 'o':
-    return checkKeyword(1, 1, "r", TokenType::TOKEN_OR);
-  case 'p':
-    return checkKeyword(1, 4, "rint", TokenType::TOKEN_PRINT);
-  case 'r':
-    return checkKeyword(1, 5, "eturn", TokenType::TOKEN_RETURN);
-  case 's':
-    return checkKeyword(1, 4, "uper", TokenType::TOKEN_SUPER);
-  case 't': {
-    if (scanner.current - scanner.start > 1) {
-      switch (scanner.start[1]) {
-      case 'h':
-        return checkKeyword(2, 2, "is", TokenType::TOKEN_THIS);
-      case 'r':
-        return checkKeyword(2, 2, "ue", TokenType::TOKEN_TRUE);
-      }
-    }
-    break;
+  const int length = (int)(scanner.current - scanner.start);
+  if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH) {
+    return TokenType::TOKEN_IDENTIFIER;
   }
-  case 'v':
-    return checkKeyword(1, 2, "ar", TokenType::TOKEN_VAR);
-  case 'w':
-    return checkKeyword(1, 4, "hile", TokenType::TOKEN_WHILE);
+
+  const Keyword* keyword = &(keywordTable[keywordHash(scanner.start, length)]);
+  if (keyword->length == length && memcmp(scanner.start, keyword->chars, length) == 0) {
+    return keyword->type;
   }
 
   return TokenType::TOKEN_IDENTIFIER;
@@ -179,23 +367,26 @@ identifierType() {
 
 static Token
 identifier() {
-  while (isAlpha(peek()) || isDigit(peek()))
-    advance();
+  do {
+    scanner.current = skipIdentifierChars(scanner.current);
+  } while (refilledAtCurrent());
   return makeToken(identifierType());
 }
 
 static Token
 number() {
-  while (isDigit(peek()))
-    advance();
+  do {
+    scanner.current = skipDigits(scanner.current);
+  } while (refilledAtCurrent());
 
   // Look for a fractional part.
   if (peek() == '.' && isDigit(peekNext())) {
     // Consume the ".".
     advance();
 
-    while (isDigit(peek()))
-      advance();
+    do {
+      scanner.current = skipDigits(scanner.current);
+    } while (refilledAtCurrent());
   }
 
   return makeToken(TokenType::TOKEN_NUMBER);
@@ -203,12 +394,9 @@ number() {
 
 static Token
 string() {
-  while (peek() != '"' && !isAtEnd()) {
-    if (peek() == '\n') {
-      scanner.line++;
-    }
-    advance();
-  }
+  do {
+    scanner.current = findStringEnd(scanner.current, &scanner.line);
+  } while (refilledAtCurrent());
 
   if (isAtEnd()) {
     return errorToken("Unterminated string.");
@@ -245,8 +433,14 @@ scanToken() {
     return makeToken(TokenType::TOKEN_LEFT_BRACE);
   case '}':
     return makeToken(TokenType::TOKEN_RIGHT_BRACE);
+  case '[':
+    return makeToken(TokenType::TOKEN_LEFT_BRACKET);
+  case ']':
+    return makeToken(TokenType::TOKEN_RIGHT_BRACKET);
   case ';':
     return makeToken(TokenType::TOKEN_SEMICOLON);
+  case ':':
+    return makeToken(TokenType::TOKEN_COLON);
   case ',':
     return makeToken(TokenType::TOKEN_COMMA);
   case '.':
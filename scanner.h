@@ -7,6 +7,9 @@ enum class TokenType {
   TOKEN_RIGHT_PAREN,
   TOKEN_LEFT_BRACE,
   TOKEN_RIGHT_BRACE,
+  TOKEN_LEFT_BRACKET,
+  TOKEN_RIGHT_BRACKET,
+  TOKEN_COLON,
   TOKEN_COMMA,
   TOKEN_DOT,
   TOKEN_MINUS,
@@ -61,9 +64,20 @@ struct Token {
   int line;
 };
 
+struct Source;
+
 void
 initScanner(const char* source);
 
+void
+initScanner(Source* source);
+
+/**
+ * Scan a fragment of an earlier source again, starting at `line`.
+ */
+void
+initScanner(const char* source, int line);
+
 Token
 scanToken();
 
@@ -0,0 +1,206 @@
+#include "source.h"
+
+#include "lims.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SOURCE_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static void
+initSource(Source* source) {
+  source->kind = SourceKind::SOURCE_NONE;
+  source->chars = nullptr;
+  source->length = 0;
+  source->reserved = 0;
+  source->stream = nullptr;
+}
+
+#ifdef SOURCE_USE_MMAP
+
+static size_t
+pageSize() {
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static size_t
+roundUpToPage(size_t size) {
+  const size_t page = pageSize();
+  return (size + page - 1) / page * page;
+}
+
+bool
+openSourceFile(Source* source, const char* path) {
+  initSource(source);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return false;
+  }
+
+  // Reserve one zero page more than the file needs, then map the file over the front of it. Whatever follows the
+  // last byte of the file is zero, which is the scanner's end sentinel.
+  const size_t fileSize = (size_t)st.st_size;
+  const size_t reserved = roundUpToPage(fileSize) + pageSize();
+  void* base = mmap(nullptr, reserved, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  if (fileSize > 0 && mmap(base, fileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(base, reserved);
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+#ifdef MADV_SEQUENTIAL
+  madvise(base, reserved, MADV_SEQUENTIAL);
+#endif
+
+  source->kind = SourceKind::SOURCE_MAPPED;
+  source->chars = (char*)base;
+  source->length = fileSize;
+  source->reserved = reserved;
+  return true;
+}
+
+bool
+openSourceStream(Source* source, FILE* stream) {
+  initSource(source);
+
+  // Reserve the address space up front so the buffer never moves; pages are only committed once written.
+  void* base = mmap(nullptr, lims::SOURCE_STREAM_RESERVE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+
+  source->kind = SourceKind::SOURCE_STREAM;
+  source->chars = (char*)base;
+  source->reserved = lims::SOURCE_STREAM_RESERVE;
+  source->stream = stream;
+  return true;
+}
+
+bool
+refillSource(Source* source) {
+  if (source->stream == nullptr) {
+    return false;
+  }
+
+  // Keep one byte for the sentinel.
+  size_t room = source->reserved - source->length - 1;
+  if (room > lims::SOURCE_STREAM_BLOCK) {
+    room = lims::SOURCE_STREAM_BLOCK;
+  }
+  if (room == 0) {
+    fprintf(stderr, "Source is larger than %zu bytes.\n", source->reserved - 1);
+    source->stream = nullptr;
+    return false;
+  }
+
+  ssize_t bytesRead;
+  do {
+    bytesRead = read(fileno(source->stream), source->chars + source->length, room);
+  } while (bytesRead < 0 && errno == EINTR);
+
+  if (bytesRead <= 0) {
+    source->stream = nullptr;
+    return false;
+  }
+
+  source->length += (size_t)bytesRead;
+  source->chars[source->length] = '\0';
+  return true;
+}
+
+void
+closeSource(Source* source) {
+  if (source->kind == SourceKind::SOURCE_MAPPED || source->kind == SourceKind::SOURCE_STREAM) {
+    munmap(source->chars, source->reserved);
+  } else if (source->kind == SourceKind::SOURCE_HEAP) {
+    free(source->chars);
+  }
+  initSource(source);
+}
+
+#else
+
+static bool
+readWhole(Source* source, FILE* file) {
+  size_t capacity = lims::SOURCE_STREAM_BLOCK;
+  char* buffer = (char*)malloc(capacity);
+  size_t length = 0;
+
+  while (buffer != nullptr) {
+    length += fread(buffer + length, sizeof(char), capacity - length - 1, file);
+    if (length < capacity - 1) {
+      break;
+    }
+    capacity *= 2;
+    char* grown = (char*)realloc(buffer, capacity);
+    if (grown == nullptr) {
+      free(buffer);
+    }
+    buffer = grown;
+  }
+
+  if (buffer == nullptr || ferror(file)) {
+    free(buffer);
+    return false;
+  }
+
+  buffer[length] = '\0';
+  source->kind = SourceKind::SOURCE_HEAP;
+  source->chars = buffer;
+  source->length = length;
+  source->reserved = capacity;
+  return true;
+}
+
+bool
+openSourceFile(Source* source, const char* path) {
+  initSource(source);
+
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  const bool ok = readWhole(source, file);
+  fclose(file);
+  return ok;
+}
+
+bool
+openSourceStream(Source* source, FILE* stream) {
+  // Without a way to reserve address space the buffer would move as it grows, so read the stream up front.
+  initSource(source);
+  return readWhole(source, stream);
+}
+
+bool
+refillSource(Source* source) {
+  return false;
+}
+
+void
+closeSource(Source* source) {
+  free(source->chars);
+  initSource(source);
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef CLOX_SOURCE_H
+#define CLOX_SOURCE_H
+
+#include "common.h"
+
+#include <cstdio>
+
+enum class SourceKind {
+  SOURCE_NONE,
+  SOURCE_MAPPED, // read-only mapping of a file
+  SOURCE_STREAM, // filled from a stream while it is scanned
+  SOURCE_HEAP,   // whole input copied to the heap
+};
+
+/**
+ * Source text handed to the scanner. `chars[length]` is always readable and '\0': mapped files get it from the
+ * zero-filled tail of their last page (or a spare page behind it), streams write it after every refill. `chars` never
+ * moves, so tokens stay valid while a stream keeps growing.
+ */
+struct Source {
+  SourceKind kind;
+  char* chars;
+  size_t length;
+  size_t reserved; // bytes of address space behind `chars`
+  FILE* stream;    // set while a stream may still have unread input
+};
+
+bool
+openSourceFile(Source* source, const char* path);
+
+bool
+openSourceStream(Source* source, FILE* stream);
+
+/**
+ * Append the next block of a streamed source. Return false once the stream is exhausted.
+ */
+bool
+refillSource(Source* source);
+
+void
+closeSource(Source* source);
+
+#endif
@@ -1,50 +1,243 @@
 #include "table.h"
 
+#include "heap.h"
 #include "memory.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define TABLE_MAX_LOAD 0.75
+// Below this a table is rebuilt at the smallest capacity that is at most half of TABLE_MAX_LOAD full, which is at
+// least a halving, so growing and shrinking can't alternate on every insert.
+#define TABLE_MIN_LOAD (TABLE_MAX_LOAD / 4)
+// Above this share of tombstones tableRemoveWhite() rehashes in place when it does not shrink the table.
+#define TABLE_MAX_TOMBSTONES 0.125
 
-void
-initTable(Table* table) {
+// Table and ValueTable share everything below except how a key is hashed and compared; the helpers that touch
+// entries are templates over the table type.
+
+template <typename T>
+static void
+initHashTable(T* table) {
   table->count = 0;
+  table->tombstones = 0;
   table->capacity = 0;
   table->entries = nullptr;
+  table->control = nullptr;
+}
+
+template <typename T>
+static size_t
+tableBytes(const T* table, int capacity) {
+  return (sizeof(*table->entries) + sizeof(int8_t)) * capacity;
+}
+
+template <typename T>
+static void
+freeHashTable(T* table) {
+  reallocate(table->entries, tableBytes(table, table->capacity), 0);
+  initHashTable(table);
+}
+
+void
+initTable(Table* table) {
+  initHashTable(table);
 }
 
 void
 freeTable(Table* table) {
-  FREE_ARRAY(Entry, table->entries, table->capacity);
-  initTable(table);
-}
-
-static Entry*
-findEntry(Entry* entries, int capacity, ObjString* key) {
-  uint32_t index = modulo(key->hash, capacity);
-  Entry* tombstone = nullptr;
-
-  for (;;) {
-    Entry* entry = &(entries[index]);
-    if (entry->key == nullptr) {
-      if (IS_NIL(entry->value)) {
-        // Empty entry.
-        return tombstone != nullptr ? tombstone : entry;
-      } else {
-        // We found a tombstone.
-        if (tombstone == nullptr) {
-          tombstone = entry;
-        }
+  freeHashTable(table);
+}
+
+void
+initValueTable(ValueTable* table) {
+  initHashTable(table);
+}
+
+void
+freeValueTable(ValueTable* table) {
+  freeHashTable(table);
+}
+
+/**
+ * Spread the bits of a number or a pointer over the hash (the 64-bit finalizer of MurmurHash3).
+ */
+static inline uint32_t
+hashBits(uint64_t bits) {
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdull;
+  bits ^= bits >> 33;
+  bits *= 0xc4ceb9fe1a85ec53ull;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
+}
+
+static inline uint64_t
+numberBits(double number) {
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  return bits;
+}
+
+/**
+ * Keys must be normalized by valueKey() first: strings interned, -0 turned into 0 and every NaN into the same one.
+ */
+static uint32_t
+hashKey(Value key) {
+  if (IS_NUMBER(key)) {
+    return hashBits(numberBits(AS_NUMBER(key)));
+  }
+  if (IS_STRING(key)) {
+    return AS_STRING(key)->hash;
+  }
+  if (IS_OBJ(key)) {
+    return hashBits((uint64_t)(uintptr_t)AS_OBJ(key));
+  }
+  return IS_NIL(key) ? 0 : hashBits(AS_BOOL(key) ? 2 : 1);
+}
+
+static inline uint32_t
+hashKey(ObjString* key) {
+  return key->hash;
+}
+
+static inline bool
+keysEqual(ObjString* a, ObjString* b) {
+  return a == b;
+}
+
+static inline bool
+keysEqual(Value a, Value b) {
+  if (IS_NUMBER(a)) {
+    return IS_NUMBER(b) && numberBits(AS_NUMBER(a)) == numberBits(AS_NUMBER(b));
+  }
+  return valuesEqual(a, b);
+}
+
+static inline int8_t
+hashTag(uint32_t hash) {
+  return (int8_t)(hash & 0x7f);
+}
+
+static inline uint32_t
+hashGroup(uint32_t hash) {
+  return hash >> 7;
+}
+
+// Each match returns a bit mask with bit i set when slot i of the group matches.
+
+#ifdef __SSE2__
+
+static inline uint32_t
+matchTag(const int8_t* group, int8_t tag) {
+  __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+}
+
+static inline uint32_t
+matchEmpty(const int8_t* group) {
+  return matchTag(group, CTRL_EMPTY);
+}
+
+static inline uint32_t
+matchEmptyOrDeleted(const int8_t* group) {
+  // Both special values have the sign bit set, tags never do.
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+
+#else
+
+static inline uint32_t
+matchTag(const int8_t* group, int8_t tag) {
+  uint32_t mask = 0;
+  for (int i = 0; i < TABLE_GROUP_SIZE; i++) {
+    mask |= (uint32_t)(group[i] == tag) << i;
+  }
+  return mask;
+}
+
+static inline uint32_t
+matchEmpty(const int8_t* group) {
+  return matchTag(group, CTRL_EMPTY);
+}
+
+static inline uint32_t
+matchEmptyOrDeleted(const int8_t* group) {
+  uint32_t mask = 0;
+  for (int i = 0; i < TABLE_GROUP_SIZE; i++) {
+    mask |= (uint32_t)(group[i] < 0) << i;
+  }
+  return mask;
+}
+
+#endif
+
+/**
+ * Groups are visited in triangular order (g, g+1, g+3, g+6, ...), which covers every group of a power-of-two table.
+ */
+struct ProbeSeq {
+  uint32_t group;
+  uint32_t stride;
+  int groupCount;
+
+  int
+  offset() const {
+    return (int)this->group * TABLE_GROUP_SIZE;
+  }
+
+  void
+  next() {
+    this->stride += 1;
+    this->group = modulo(this->group + this->stride, this->groupCount);
+  }
+};
+
+static ProbeSeq
+probeSeq(uint32_t hash, int capacity) {
+  const int groupCount = capacity / TABLE_GROUP_SIZE;
+  return ProbeSeq{modulo(hashGroup(hash), groupCount), 0, groupCount};
+}
+
+/**
+ * Return the slot holding `key`, or -1.
+ */
+template <typename T, typename K>
+static int
+findSlot(const T* table, K key) {
+  const uint32_t hash = hashKey(key);
+  const int8_t tag = hashTag(hash);
+  for (ProbeSeq seq = probeSeq(hash, table->capacity);; seq.next()) {
+    const int8_t* group = table->control + seq.offset();
+    for (uint32_t match = matchTag(group, tag); match != 0; match &= match - 1) {
+      const int slot = seq.offset() + lowestBit(match);
+      if (keysEqual(table->entries[slot].key, key)) {
+        return slot;
       }
-    } else if (entry->key == key) { //
-      // We found the key.
-      return entry;
     }
+    if (matchEmpty(group) != 0) {
+      return -1;
+    }
+  }
+}
 
-    index = modulo(index + 1, capacity);
+/**
+ * Return the first empty or deleted slot on the probe sequence of `hash`.
+ */
+static int
+findInsertSlot(const int8_t* control, int capacity, uint32_t hash) {
+  for (ProbeSeq seq = probeSeq(hash, capacity);; seq.next()) {
+    const uint32_t match = matchEmptyOrDeleted(control + seq.offset());
+    if (match != 0) {
+      return seq.offset() + lowestBit(match);
+    }
   }
 }
 
@@ -53,58 +246,183 @@ tableGet(Table* table, ObjString* key, Value* value) {
   if (table->count == 0) {
     return false;
   }
+  // An uninterned key can only match an entry if its characters have been interned before.
+  key = findInternedString(key);
+  if (key == nullptr) {
+    return false;
+  }
 
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  if (entry->key == nullptr) {
+  const int slot = findSlot(table, key);
+  if (slot < 0) {
     return false;
   }
 
-  *value = entry->value;
+  *value = table->entries[slot].value;
   return true;
 }
 
+/**
+ * Place the live entries of `table` into the empty arrays `entries`, sized for `capacity`, and switch the table over
+ * to them. The old arrays are left to the caller.
+ */
+template <typename T, typename E>
 static void
-adjustCapacity(Table* table, int capacity) {
-  Entry* entries = ALLOCATE(Entry, capacity);
-  for (int i = 0; i < capacity; i++) {
-    entries[i].key = nullptr;
-    entries[i].value = NIL_VAL;
-  }
+moveEntries(T* table, E* entries, int capacity) {
+  int8_t* control = (int8_t*)(entries + capacity);
+  memset(control, CTRL_EMPTY, capacity);
 
   table->count = 0;
+  table->tombstones = 0;
   for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &(table->entries[i]);
-    if (entry->key == nullptr) {
+    if (table->control[i] < 0) {
       continue;
     }
 
-    Entry* dest = findEntry(entries, capacity, entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
+    const uint32_t hash = hashKey(table->entries[i].key);
+    const int slot = findInsertSlot(control, capacity, hash);
+    control[slot] = hashTag(hash);
+    entries[slot] = table->entries[i];
     table->count += 1;
   }
 
-  FREE_ARRAY(Entry, table->entries, table->capacity);
   table->entries = entries;
+  table->control = control;
   table->capacity = capacity;
 }
 
+template <typename T>
+static void
+adjustCapacity(T* table, int capacity) {
+  auto entries = (decltype(table->entries))reallocate(nullptr, 0, tableBytes(table, capacity));
+  auto old = table->entries;
+  const size_t oldBytes = tableBytes(table, table->capacity);
+  moveEntries(table, entries, capacity);
+  reallocate(old, oldBytes, 0);
+}
+
+/**
+ * Rehash at the same capacity without allocating, turning every tombstone back into an empty slot. Live control bytes
+ * are first flipped to CTRL_DELETED to mean "not placed yet"; each is then kept if its group is still the first on its
+ * probe sequence with room, moved to an empty slot, or swapped with another unplaced entry that gets revisited.
+ */
+template <typename T>
+static void
+rehashInPlace(T* table) {
+  int8_t* control = table->control;
+  for (int i = 0; i < table->capacity; i++) {
+    control[i] = control[i] < 0 ? CTRL_EMPTY : CTRL_DELETED;
+  }
+
+  for (int i = 0; i < table->capacity; i++) {
+    if (control[i] != CTRL_DELETED) {
+      continue;
+    }
+
+    auto entry = &(table->entries[i]);
+    const uint32_t hash = hashKey(entry->key);
+    const int slot = findInsertSlot(control, table->capacity, hash);
+    if (slot / TABLE_GROUP_SIZE == i / TABLE_GROUP_SIZE) {
+      control[i] = hashTag(hash);
+      continue;
+    }
+
+    if (control[slot] == CTRL_EMPTY) {
+      table->entries[slot] = *entry;
+      control[slot] = hashTag(hash);
+      control[i] = CTRL_EMPTY;
+    } else {
+      auto placed = *entry;
+      *entry = table->entries[slot];
+      table->entries[slot] = placed;
+      control[slot] = hashTag(hash);
+      i -= 1; // Place the entry swapped into slot i.
+    }
+  }
+
+  table->tombstones = 0;
+}
+
+static int
+capacityFor(int count) {
+  int capacity = TABLE_GROUP_SIZE;
+  while (count > capacity * TABLE_MAX_LOAD / 2) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+/**
+ * Called before inserting a new key: shrink a table that has mostly emptied, clear out tombstones when they are what
+ * fills it, and otherwise grow it once it is full.
+ */
+template <typename T>
+static void
+reserveForInsert(T* table) {
+  const int count = table->count + 1;
+  if (table->capacity > TABLE_GROUP_SIZE && count < table->capacity * TABLE_MIN_LOAD) {
+    adjustCapacity(table, capacityFor(count));
+  } else if (count + table->tombstones > table->capacity * TABLE_MAX_LOAD) {
+    if (count <= table->capacity * TABLE_MAX_LOAD / 2) {
+      rehashInPlace(table);
+    } else {
+      adjustCapacity(table, table->capacity < TABLE_GROUP_SIZE ? TABLE_GROUP_SIZE : table->capacity * 2);
+    }
+  }
+}
+
+/**
+ * Put a key that is known to be missing into a table that has room for it.
+ */
+template <typename T, typename K>
+static void
+insertEntry(T* table, K key, Value value) {
+  const uint32_t hash = hashKey(key);
+  const int slot = findInsertSlot(table->control, table->capacity, hash);
+  if (table->control[slot] == CTRL_DELETED) {
+    table->tombstones -= 1;
+  }
+
+  table->count += 1;
+  table->control[slot] = hashTag(hash);
+  table->entries[slot].key = key;
+  table->entries[slot].value = value;
+}
+
 bool
 tableSet(Table* table, ObjString* key, Value value) {
-  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-    int capacity = GROW_CAPACITY(table->capacity);
-    adjustCapacity(table, capacity);
+  key = internString(key);
+  if (table->count > 0) {
+    const int slot = findSlot(table, key);
+    if (slot >= 0) {
+      table->entries[slot].value = value;
+      return false;
+    }
   }
 
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  bool isNewKey = entry->key == nullptr;
-  if (isNewKey && IS_NIL(entry->value)) {
-    table->count += 1;
-  }
+  // NOTE: the caller roots the key it passed, not necessarily the interned one found for it
+  push(OBJ_VAL(key));
+  reserveForInsert(table);
+  pop();
 
-  entry->key = key;
-  entry->value = value;
-  return isNewKey;
+  insertEntry(table, key, value);
+  return true;
+}
+
+/**
+ * A probe only moves past a group that had no empty slot, so a slot in a group that still has one can go straight
+ * back to empty; anywhere else it needs a tombstone.
+ */
+template <typename T>
+static void
+eraseSlot(T* table, int slot) {
+  const int8_t* group = table->control + slot / TABLE_GROUP_SIZE * TABLE_GROUP_SIZE;
+  if (matchEmpty(group) != 0) {
+    table->control[slot] = CTRL_EMPTY;
+  } else {
+    table->control[slot] = CTRL_DELETED;
+    table->tombstones += 1;
+  }
+  table->count -= 1;
 }
 
 bool
@@ -112,24 +430,25 @@ tableDelete(Table* table, ObjString* key) {
   if (table->count == 0) {
     return false;
   }
+  key = findInternedString(key);
+  if (key == nullptr) {
+    return false;
+  }
 
-  // Find the entry.
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  if (entry->key == nullptr) {
+  const int slot = findSlot(table, key);
+  if (slot < 0) {
     return false;
   }
 
-  // Place a tombstone in the entry.
-  entry->key = nullptr;
-  entry->value = BOOL_VAL(true);
+  eraseSlot(table, slot);
   return true;
 }
 
 void
 tableAddAll(Table* from, Table* to) {
   for (int i = 0; i < from->capacity; i++) {
-    Entry* entry = &(from->entries[i]);
-    if (entry->key != nullptr) {
+    if (from->control[i] >= 0) {
+      Entry* entry = &(from->entries[i]);
       tableSet(to, entry->key, entry->value);
     }
   }
@@ -141,39 +460,179 @@ tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
     return nullptr;
   }
 
-  uint32_t index = modulo(hash, table->capacity);
-  for (;;) {
-    Entry* entry = &(table->entries[index]);
-    if (entry->key == nullptr) {
-      // Stop if we find an empty non-tombstone entry.
-      if (IS_NIL(entry->value)) {
-        return nullptr;
+  const int8_t tag = hashTag(hash);
+  for (ProbeSeq seq = probeSeq(hash, table->capacity);; seq.next()) {
+    const int8_t* group = table->control + seq.offset();
+    for (uint32_t match = matchTag(group, tag); match != 0; match &= match - 1) {
+      ObjString* key = table->entries[seq.offset() + lowestBit(match)].key;
+      if (key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0) {
+        // We found it.
+        return key;
       }
-    } else if (entry->key->length == length && entry->key->hash == hash &&
-               memcmp(entry->key->chars, chars, length) == 0) {
-      // We found it.
-      return entry->key;
     }
-
-    index = modulo(index + 1, table->capacity);
+    if (matchEmpty(group) != 0) {
+      return nullptr;
+    }
   }
 }
 
 void
 tableRemoveWhite(Table* table) {
   for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &(table->entries[i]);
-    if (entry->key != nullptr && !entry->key->obj.isMarked) {
-      tableDelete(table, entry->key);
+    if (table->control[i] >= 0 && !isMarked((Obj*)table->entries[i].key)) {
+      eraseSlot(table, i);
     }
   }
+
+  // NOTE: this runs inside a collection, so the smaller arrays come straight from malloc(); reallocate() could start
+  // another one
+  if (table->capacity > TABLE_GROUP_SIZE && table->count < table->capacity * TABLE_MIN_LOAD) {
+    const int capacity = capacityFor(table->count);
+    auto entries = (Entry*)malloc(tableBytes(table, capacity));
+    if (entries != nullptr) {
+      Entry* old = table->entries;
+      const size_t oldBytes = tableBytes(table, table->capacity);
+      moveEntries(table, entries, capacity);
+      free(old);
+      vm.bytesAllocated -= oldBytes - tableBytes(table, capacity);
+      return;
+    }
+  }
+
+  if (table->tombstones > table->capacity * TABLE_MAX_TOMBSTONES) {
+    rehashInPlace(table);
+  }
 }
 
 void
 markTable(Table* table) {
   for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &(table->entries[i]);
-    markObject((Obj*)(entry->key));
-    markValue(entry->value);
+    if (table->control[i] >= 0) {
+      Entry* entry = &(table->entries[i]);
+      markObject((Obj*)(entry->key));
+      markValue(entry->value);
+    }
+  }
+}
+
+/**
+ * Turn `key` into the form it is stored in: -0 becomes 0, every NaN the same NaN, and a string its interned string.
+ * Without `intern` a string that was never interned can't be a key, and false is returned.
+ */
+static bool
+valueKey(Value key, bool intern, Value* normalized) {
+  if (IS_NUMBER(key)) {
+    const double number = AS_NUMBER(key);
+    if (number == 0) {
+      *normalized = NUMBER_VAL(0);
+    } else if (number != number) {
+      *normalized = NUMBER_VAL(NAN);
+    } else {
+      *normalized = key;
+    }
+    return true;
+  }
+
+  if (IS_STRING(key)) {
+    ObjString* string = intern ? internString(AS_STRING(key)) : findInternedString(AS_STRING(key));
+    if (string == nullptr) {
+      return false;
+    }
+    *normalized = OBJ_VAL(string);
+    return true;
+  }
+
+  *normalized = key;
+  return true;
+}
+
+bool
+valueTableGet(ValueTable* table, Value key, Value* value) {
+  if (table->count == 0 || !valueKey(key, false, &key)) {
+    return false;
+  }
+
+  const int slot = findSlot(table, key);
+  if (slot < 0) {
+    return false;
+  }
+
+  *value = table->entries[slot].value;
+  return true;
+}
+
+bool
+valueTableSet(ValueTable* table, Value key, Value value) {
+  valueKey(key, true, &key);
+  if (table->count > 0) {
+    const int slot = findSlot(table, key);
+    if (slot >= 0) {
+      table->entries[slot].value = value;
+      return false;
+    }
+  }
+
+  push(key);
+  reserveForInsert(table);
+  pop();
+
+  insertEntry(table, key, value);
+  return true;
+}
+
+bool
+valueTableDelete(ValueTable* table, Value key) {
+  if (table->count == 0 || !valueKey(key, false, &key)) {
+    return false;
+  }
+
+  const int slot = findSlot(table, key);
+  if (slot < 0) {
+    return false;
+  }
+
+  eraseSlot(table, slot);
+  return true;
+}
+
+void
+markValueTable(ValueTable* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->control[i] >= 0) {
+      ValueEntry* entry = &(table->entries[i]);
+      markValue(entry->key);
+      markValue(entry->value);
+    }
+  }
+}
+
+void
+relocateTable(Table* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->control[i] >= 0) {
+      Entry* entry = &(table->entries[i]);
+      // NOTE: strings hash by content, the slots stay as they are
+      entry->key = (ObjString*)forwardedObject((Obj*)(entry->key));
+      relocateValue(&(entry->value));
+    }
+  }
+}
+
+void
+relocateValueTable(ValueTable* table) {
+  bool movedKey = false;
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->control[i] >= 0) {
+      ValueEntry* entry = &(table->entries[i]);
+      const Value key = entry->key;
+      relocateValue(&(entry->key));
+      movedKey = movedKey || (IS_OBJ(key) && AS_OBJ(entry->key) != AS_OBJ(key) && !IS_STRING(entry->key));
+      relocateValue(&(entry->value));
+    }
+  }
+
+  // Other objects hash by address.
+  if (movedKey) {
+    rehashInPlace(table);
   }
 }
@@ -9,12 +9,40 @@ struct Entry {
   Value value;
 };
 
+struct ValueEntry {
+  Value key;
+  Value value;
+};
+
+/**
+ * Open addressing in groups of TABLE_GROUP_SIZE slots. Each slot has a control byte: CTRL_EMPTY, CTRL_DELETED (a
+ * tombstone), or the low 7 bits of the key's hash. A probe compares a whole group of control bytes at once and only
+ * looks at the entries whose tag matches.
+ */
 struct Table {
-  int count;
+  int count; // live entries
+  int tombstones;
   int capacity;
   Entry* entries;
+  int8_t* control; // `capacity` control bytes, allocated right behind `entries`
+};
+
+/**
+ * The same layout as Table, keyed by any value: numbers by their bits, strings by content and other objects by
+ * identity.
+ */
+struct ValueTable {
+  int count; // live entries
+  int tombstones;
+  int capacity;
+  ValueEntry* entries;
+  int8_t* control;
 };
 
+constexpr int TABLE_GROUP_SIZE = 16;
+constexpr int8_t CTRL_EMPTY = -128;
+constexpr int8_t CTRL_DELETED = -2;
+
 void
 initTable(Table* table);
 
@@ -42,6 +70,36 @@ tableRemoveWhite(Table* table);
 void
 markTable(Table* table);
 
+/**
+ * Update keys and values after a compaction moved objects.
+ */
+void
+relocateTable(Table* table);
+
+void
+initValueTable(ValueTable* table);
+
+void
+freeValueTable(ValueTable* table);
+
+bool
+valueTableGet(ValueTable* table, Value key, Value* value);
+
+bool
+valueTableSet(ValueTable* table, Value key, Value value);
+
+bool
+valueTableDelete(ValueTable* table, Value key);
+
+void
+markValueTable(ValueTable* table);
+
+/**
+ * relocateTable() for a ValueTable; rehashes it if an object key moved.
+ */
+void
+relocateValueTable(ValueTable* table);
+
 inline uint32_t
 modulo(uint32_t index, int capacity) {
   return index & (capacity - 1);
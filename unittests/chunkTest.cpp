@@ -7,3 +7,43 @@ TEST(ChunkTest, CtoTC) {
   ASSERT_EQ(0, chunk.code.count);
   ASSERT_EQ(0, chunk.lines.count);
 }
+
+TEST(ChunkTest, LineRunsTC) {
+  Chunk chunk;
+  chunk.writeChunk(0, 1);
+  chunk.writeChunk(0, 1);
+  chunk.writeChunk(0, 1);
+  chunk.writeChunk(0, 3);
+  chunk.writeChunk(0, 4);
+  chunk.writeChunk(0, 4);
+  ASSERT_EQ(6, chunk.code.count);
+  ASSERT_EQ(3, chunk.lines.count);
+
+  ASSERT_EQ(1, chunk.getLine(0));
+  ASSERT_EQ(1, chunk.getLine(2));
+  ASSERT_EQ(3, chunk.getLine(3));
+  ASSERT_EQ(4, chunk.getLine(4));
+  ASSERT_EQ(4, chunk.getLine(5));
+}
+
+TEST(ChunkTest, BindingCacheTC) {
+  Chunk chunk;
+  ASSERT_EQ(0, chunk.addBindingCache());
+  ASSERT_EQ(1, chunk.addBindingCache());
+  for (int i = 2; i < 300; i++) {
+    chunk.addBindingCache();
+  }
+  ASSERT_EQ(256, chunk.bindings.count);
+  ASSERT_EQ(255, chunk.addBindingCache());
+}
+
+TEST(ChunkTest, SuperCacheTC) {
+  Chunk chunk;
+  ASSERT_EQ(0, chunk.addSuperCache());
+  ASSERT_EQ(nullptr, chunk.superCaches[0].superclass);
+  for (int i = 1; i < 300; i++) {
+    chunk.addSuperCache();
+  }
+  ASSERT_EQ(256, chunk.superCaches.count);
+  ASSERT_EQ(255, chunk.addSuperCache());
+}
@@ -0,0 +1,69 @@
+#include "heap.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+static void
+countFreed(Obj* object, void* context) {
+  *(int*)context += 1;
+  heapRelease(object);
+}
+
+TEST(HeapTest, SlotOfTC) {
+  // The reciprocal must give the same slot as a division, for every size class and every byte of a page.
+  Heap heap;
+  initHeap(&heap);
+  for (size_t size = HEAP_SLOT_ALIGN; size <= HEAP_SLOT_MAX; size += HEAP_SLOT_ALIGN) {
+    HeapPage* page = pageOf(heapAllocate(&heap, size, countFreed, nullptr));
+    for (size_t offset = 0; offset < HEAP_PAGE_SIZE - HEAP_PAGE_HEADER; offset++) {
+      const char* address = (const char*)page + HEAP_PAGE_HEADER + offset;
+      ASSERT_EQ((int)(offset / size), slotOf(page, address));
+    }
+  }
+  freeHeap(&heap);
+}
+
+TEST(HeapTest, SweepTC) {
+  Heap heap;
+  initHeap(&heap);
+
+  std::vector<Obj*> objects;
+  for (int i = 0; i < 10000; i++) {
+    Obj* object = (Obj*)heapAllocate(&heap, 40, countFreed, nullptr);
+    ASSERT_EQ(0u, (uintptr_t)object % HEAP_SLOT_ALIGN);
+    ASSERT_FALSE(isMarked(object));
+    objects.push_back(object);
+  }
+  const int pages = heap.pageCount;
+  ASSERT_LT(1, pages);
+
+  // Keep every third object.
+  for (size_t i = 0; i < objects.size(); i += 3) {
+    ASSERT_TRUE(setMarked(objects[i]));
+    ASSERT_FALSE(setMarked(objects[i]));
+  }
+
+  int freed = 0;
+  heapStartSweep(&heap);
+  ASSERT_EQ(pages, heap.unsweptCount);
+  sweepHeapPages(&heap, 1, countFreed, &freed);
+  ASSERT_EQ(pages - 1, heap.unsweptCount);
+  sweepHeapPages(&heap, pages, countFreed, &freed);
+  ASSERT_EQ(0, heap.unsweptCount);
+  ASSERT_EQ(10000 - 3334, freed);
+  for (size_t i = 0; i < objects.size(); i += 3) {
+    ASSERT_FALSE(isMarked(objects[i]));
+  }
+
+  // Freed slots are reused before a new page is taken.
+  for (int i = 0; i < freed; i++) {
+    heapAllocate(&heap, 40, countFreed, nullptr);
+  }
+  ASSERT_EQ(pages, heap.pageCount);
+
+  int count = 0;
+  heapEach(&heap, [](Obj* object, void* context) { *(int*)context += 1; }, &count);
+  ASSERT_EQ(10000, count);
+  freeHeap(&heap);
+}
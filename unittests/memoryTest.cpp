@@ -0,0 +1,207 @@
+#include "memory.h"
+
+#include "lims.h"
+#include "object.h"
+#include "vm.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+class MemoryTest : public testing::Test {
+protected:
+  void
+  SetUp() override {
+    initVM();
+  }
+
+  void
+  TearDown() override {
+    freeVM();
+  }
+};
+
+TEST_F(MemoryTest, GCStatsTC) {
+  ASSERT_EQ(0u, vm.gcStats.collections);
+
+  // Unreachable strings are freed; the one on the stack survives.
+  for (int i = 0; i < 10; i++) {
+    copyString("garbage", 7 - (i % 7));
+  }
+  push(OBJ_VAL(newList()));
+  size_t before[OBJ_TYPE_COUNT];
+  countObjects(before);
+  ASSERT_EQ(1u, before[(int)ObjType::OBJ_LIST]);
+
+  // A collection only marks; the garbage goes when the sweep is finished.
+  collectGarbage();
+  ASSERT_EQ(0u, vm.gcStats.objectsFreed);
+  ASSERT_LT(0, vm.heap.unsweptCount);
+  collectGarbage();
+  finishSweep();
+  ASSERT_EQ(0, vm.heap.unsweptCount);
+  pop();
+
+  const GCStats* stats = &(vm.gcStats);
+  ASSERT_EQ(2u, stats->collections);
+  ASSERT_EQ(7u, stats->objectsFreed);
+  ASSERT_LT(0u, stats->bytesFreed);
+  ASSERT_EQ(stats->totalPauseNanos >= stats->maxPauseNanos, true);
+
+  uint64_t pauses = 0;
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    pauses += stats->pauseHistogram[i];
+  }
+  ASSERT_EQ(2u, pauses);
+
+  ASSERT_EQ(vm.bytesAllocated, stats->history[1].liveBytes);
+  ASSERT_EQ(vm.nextGC, stats->history[1].nextGC);
+
+  size_t after[OBJ_TYPE_COUNT];
+  countObjects(after);
+  ASSERT_EQ(before[(int)ObjType::OBJ_STRING] - 7, after[(int)ObjType::OBJ_STRING]);
+  ASSERT_EQ(1u, after[(int)ObjType::OBJ_LIST]);
+}
+
+TEST_F(MemoryTest, ParseConfigTC) {
+  size_t bytes = 0;
+  ASSERT_TRUE(parseByteSize("512", &bytes));
+  ASSERT_EQ(512u, bytes);
+  ASSERT_TRUE(parseByteSize("64K", &bytes));
+  ASSERT_EQ(64u * 1024, bytes);
+  ASSERT_TRUE(parseByteSize("3m", &bytes));
+  ASSERT_EQ(3u * 1024 * 1024, bytes);
+  ASSERT_FALSE(parseByteSize("", &bytes));
+  ASSERT_FALSE(parseByteSize("-1", &bytes));
+  ASSERT_FALSE(parseByteSize("12MB", &bytes));
+
+  double factor = 0;
+  ASSERT_TRUE(parseGrowFactor("1.5", &factor));
+  ASSERT_EQ(1.5, factor);
+  ASSERT_FALSE(parseGrowFactor("0.5", &factor));
+  ASSERT_FALSE(parseGrowFactor("two", &factor));
+
+  double share = 1;
+  ASSERT_TRUE(parseHeapShare("0.25", &share));
+  ASSERT_EQ(0.25, share);
+  ASSERT_FALSE(parseHeapShare("1.5", &share));
+}
+
+TEST_F(MemoryTest, HeapLimitTC) {
+  freeVM();
+  GCConfig config = defaultGCConfig();
+  config.heapLimit = 256 * 1024;
+  initVM(&config);
+
+  const size_t before = vm.bytesAllocated;
+  ASSERT_THROW(reallocate(nullptr, 0, 512 * 1024), OutOfMemory);
+  ASSERT_EQ(before, vm.bytesAllocated);
+  ASSERT_EQ(1u, vm.gcStats.collections); // it collected before giving up
+
+  void* block = reallocate(nullptr, 0, 1024);
+  ASSERT_NE(nullptr, block);
+  reallocate(block, 1024, 0);
+}
+
+TEST_F(MemoryTest, OutOfMemoryLeakTC) {
+  freeVM();
+  GCConfig config = defaultGCConfig();
+  config.heapLimit = 256 * 1024;
+  initVM(&config);
+
+  const size_t filler = config.heapLimit - vm.bytesAllocated - 1024;
+  void* block = reallocate(nullptr, 0, filler);
+  finishSweep();
+
+  // There is room for the characters but not for the string that would own them; they must be given back.
+  const size_t before = vm.bytesAllocated;
+  const int length = (int)(config.heapLimit - before) - 8;
+  char chars[1024];
+  memset(chars, 'x', sizeof(chars));
+  ASSERT_THROW(copyString(chars, length), OutOfMemory);
+  ASSERT_EQ(before, vm.bytesAllocated);
+  reallocate(block, filler, 0);
+}
+
+TEST_F(MemoryTest, ParallelMarkTC) {
+  freeVM();
+  GCConfig config = defaultGCConfig();
+  config.markThreads = 4;
+  initVM(&config);
+
+  // One list holds every other list; the rest is garbage. The heap must be big enough to be marked in parallel.
+  ObjList* kept = newList();
+  push(OBJ_VAL(kept));
+  while (vm.bytesAllocated < lims::GC_PARALLEL_MARK_MIN * 2) {
+    ObjList* item = newList();
+    push(OBJ_VAL(item));
+    item->items.push(NUMBER_VAL(kept->items.count));
+    kept->items.push(OBJ_VAL(item));
+    pop();
+    newList();
+  }
+
+  // The marker threads are parked between collections and woken for the next one.
+  for (int round = 0; round < 3; round++) {
+    collectGarbage();
+    size_t counts[OBJ_TYPE_COUNT];
+    countObjects(counts);
+    ASSERT_EQ((size_t)kept->items.count + 1, counts[(int)ObjType::OBJ_LIST]);
+    for (int i = 0; i < kept->items.count; i++) {
+      ObjList* item = AS_LIST(kept->items[i]);
+      ASSERT_EQ(i, AS_NUMBER(item->items[0]));
+      ASSERT_FALSE(isMarked((Obj*)item));
+    }
+  }
+  pop();
+}
+
+TEST_F(MemoryTest, CompactTC) {
+  // Keep one list in eight and one string in sixteen: every page ends up mostly empty.
+  ObjList* kept = newList();
+  push(OBJ_VAL(kept));
+  ObjMap* byList = newMap();
+  push(OBJ_VAL(byList));
+  char name[16];
+  for (int i = 0; i < 40000; i++) {
+    ObjList* item = newList();
+    if (i % 8 == 0) {
+      push(OBJ_VAL(item));
+      kept->items.push(OBJ_VAL(item));
+      valueTableSet(&(byList->entries), OBJ_VAL(item), NUMBER_VAL(i));
+      pop();
+    }
+    ObjString* string = copyString(name, snprintf(name, sizeof(name), "s%d", i));
+    if (i % 16 == 0) {
+      push(OBJ_VAL(string));
+      kept->items.push(OBJ_VAL(string));
+      pop();
+    }
+  }
+
+  const int pagesBefore = vm.heap.pageCount;
+  compactGarbage();
+  ASSERT_EQ(1u, vm.gcStats.compactions);
+  ASSERT_LT(0u, vm.gcStats.objectsMoved);
+  ASSERT_GT(pagesBefore / 2, vm.heap.pageCount);
+
+  // The pointers above are stale; the stack has been updated.
+  byList = AS_MAP(pop());
+  kept = AS_LIST(pop());
+  int lists = 0;
+  for (int i = 0; i < kept->items.count; i++) {
+    if (IS_STRING(kept->items[i])) {
+      snprintf(name, sizeof(name), "s%d", (lists - 1) * 8);
+      ASSERT_STREQ(name, AS_CSTRING(kept->items[i]));
+      ASSERT_EQ(AS_STRING(kept->items[i]), tableFindString(&(vm.strings), name, (int)strlen(name),
+                                                           AS_STRING(kept->items[i])->hash));
+      continue;
+    }
+    Value index;
+    ASSERT_TRUE(valueTableGet(&(byList->entries), kept->items[i], &index));
+    ASSERT_EQ(lists * 8, AS_NUMBER(index));
+    lists += 1;
+  }
+  ASSERT_EQ(5000, lists);
+}
@@ -0,0 +1,67 @@
+#include "numeric.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+// Lengths around the vector widths, so the vector loops and the scalar tails both run.
+static const int LENGTHS[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 33, 100};
+
+static void
+fill(double* values, int count, double seed) {
+  for (int i = 0; i < count; i++) {
+    values[i] = std::sin(seed + i) * 100;
+  }
+}
+
+TEST(NumericTest, SumDotTC) {
+  double a[100];
+  double b[100];
+  for (int count : LENGTHS) {
+    fill(a, count, 1);
+    fill(b, count, 2);
+    double sum = 0;
+    double dot = 0;
+    for (int i = 0; i < count; i++) {
+      sum += a[i];
+      dot += a[i] * b[i];
+    }
+    ASSERT_NEAR(sum, sumFloat64(a, count), 1e-9);
+    ASSERT_NEAR(dot, dotFloat64(a, b, count), 1e-6);
+  }
+  ASSERT_EQ(0, sumFloat64(a, 0));
+}
+
+TEST(NumericTest, ScaleAddTC) {
+  double a[100];
+  double b[100];
+  for (int count : LENGTHS) {
+    fill(a, count, 3);
+    fill(b, count, 4);
+    scaleFloat64(a, count, 2);
+    addFloat64(a, b, count);
+    for (int i = 0; i < count; i++) {
+      ASSERT_EQ(std::sin(3.0 + i) * 100 * 2 + b[i], a[i]);
+    }
+  }
+}
+
+TEST(NumericTest, MinMaxTC) {
+  double a[100];
+  for (int count : LENGTHS) {
+    fill(a, count, 5);
+    double min = a[0];
+    double max = a[0];
+    for (int i = 1; i < count; i++) {
+      min = a[i] < min ? a[i] : min;
+      max = a[i] > max ? a[i] : max;
+    }
+    ASSERT_EQ(min, minFloat64(a, count));
+    ASSERT_EQ(max, maxFloat64(a, count));
+  }
+
+  // A NaN after the first element is skipped.
+  double withNaN[] = {1, NAN, -3, 4, NAN, 2};
+  ASSERT_EQ(-3, minFloat64(withNaN, 6));
+  ASSERT_EQ(4, maxFloat64(withNaN, 6));
+}
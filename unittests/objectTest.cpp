@@ -0,0 +1,159 @@
+#include "object.h"
+
+#include "lims.h"
+#include "table.h"
+#include "vm.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+class ObjectTest : public testing::Test {
+protected:
+  void
+  SetUp() override {
+    initVM();
+  }
+
+  void
+  TearDown() override {
+    freeVM();
+  }
+
+  /**
+   * `a + b` in the script; both sides stay reachable while the result is allocated.
+   */
+  static ObjString*
+  concat(ObjString* a, ObjString* b) {
+    push(OBJ_VAL(a));
+    push(OBJ_VAL(b));
+    ObjString* result = concatenateStrings(a, b);
+    pop();
+    pop();
+    return result;
+  }
+
+  /**
+   * A flat string of `length` copies of `c`.
+   */
+  static ObjString*
+  repeated(char c, int length) {
+    std::string text(length, c);
+    return copyString(text.c_str(), length);
+  }
+
+  /**
+   * A rope of ROPE_MIN_LENGTH copies of `a` followed by as many of `b`.
+   */
+  static ObjString*
+  ropeOf(char a, char b) {
+    ObjString* left = repeated(a, lims::ROPE_MIN_LENGTH);
+    push(OBJ_VAL(left));
+    ObjString* rope = concat(left, repeated(b, lims::ROPE_MIN_LENGTH));
+    pop();
+    return rope;
+  }
+};
+
+TEST_F(ObjectTest, ConcatenateTC) {
+  const int half = lims::ROPE_MIN_LENGTH / 2;
+  ObjString* a = repeated('a', half);
+  push(OBJ_VAL(a));
+
+  // Just short of the limit the characters are copied; at the limit a rope refers to both sides.
+  ObjString* flat = concat(a, repeated('b', half - 1));
+  ASSERT_NE(nullptr, flat->chars);
+  ASSERT_EQ(lims::ROPE_MIN_LENGTH - 1, flat->length);
+  ASSERT_FALSE(flat->interned);
+
+  ObjString* rope = concat(a, repeated('b', half));
+  ASSERT_EQ(nullptr, rope->chars);
+  ASSERT_EQ(lims::ROPE_MIN_LENGTH, rope->length);
+  ASSERT_EQ(a, rope->left);
+
+  push(OBJ_VAL(rope));
+  const std::string expected = std::string(half, 'a') + std::string(half, 'b');
+  ASSERT_EQ(expected, flattenString(rope));
+  ASSERT_EQ(nullptr, rope->left);
+  ASSERT_EQ('\0', rope->chars[rope->length]);
+  pop();
+  pop();
+}
+
+TEST_F(ObjectTest, FlattenDeepRopeTC) {
+  const int pieces = 2000;
+  ObjString* piece = copyString("0123456789", 10);
+  push(OBJ_VAL(piece));
+
+  // Appending leans the rope to the left, prepending to the right.
+  for (int prepend = 0; prepend < 2; prepend++) {
+    ObjString* rope = repeated('x', lims::ROPE_MIN_LENGTH);
+    push(OBJ_VAL(rope));
+    std::string expected(lims::ROPE_MIN_LENGTH, 'x');
+    for (int i = 0; i < pieces; i++) {
+      rope = prepend ? concat(piece, rope) : concat(rope, piece);
+      pop();
+      push(OBJ_VAL(rope));
+      expected = prepend ? "0123456789" + expected : expected + "0123456789";
+    }
+
+    ASSERT_EQ(nullptr, rope->chars);
+    ASSERT_EQ((int)expected.size(), rope->length);
+    ASSERT_EQ(expected, flattenString(rope));
+    pop();
+  }
+  pop();
+}
+
+TEST_F(ObjectTest, RopeEqualityTC) {
+  const std::string text = std::string(lims::ROPE_MIN_LENGTH, 'a') + std::string(lims::ROPE_MIN_LENGTH, 'b');
+  ObjString* rope = ropeOf('a', 'b');
+  push(OBJ_VAL(rope));
+  ObjString* flat = copyString(text.c_str(), (int)text.size());
+  push(OBJ_VAL(flat));
+  ObjString* other = ropeOf('b', 'a');
+  push(OBJ_VAL(other));
+
+  ASSERT_EQ(nullptr, rope->chars);
+  ASSERT_TRUE(valuesEqual(OBJ_VAL(rope), OBJ_VAL(flat)));
+  ASSERT_TRUE(valuesEqual(OBJ_VAL(flat), OBJ_VAL(rope)));
+  ASSERT_FALSE(valuesEqual(OBJ_VAL(rope), OBJ_VAL(other)));
+  ASSERT_FALSE(valuesEqual(OBJ_VAL(rope), OBJ_VAL(repeated('a', 2 * lims::ROPE_MIN_LENGTH))));
+
+  // Interning a rope finds the flat string with its characters.
+  ASSERT_EQ(flat, findInternedString(rope));
+  ASSERT_EQ(flat, internString(rope));
+  ASSERT_EQ(nullptr, findInternedString(other));
+  pop();
+  pop();
+  pop();
+}
+
+TEST_F(ObjectTest, RopeTableKeyTC) {
+  Table table;
+  initTable(&table);
+  ObjString* key = ropeOf('k', 'v');
+  push(OBJ_VAL(key));
+
+  // A rope stored as a key is interned, and found again by a flat string or another rope with the same characters.
+  ASSERT_TRUE(tableSet(&table, key, NUMBER_VAL(1)));
+  ASSERT_TRUE(key->interned);
+  ObjString* again = ropeOf('k', 'v');
+  push(OBJ_VAL(again));
+  Value value;
+  ASSERT_TRUE(tableGet(&table, again, &value));
+  ASSERT_EQ(1, AS_NUMBER(value));
+  ASSERT_FALSE(again->interned);
+
+  const std::string text = std::string(lims::ROPE_MIN_LENGTH, 'k') + std::string(lims::ROPE_MIN_LENGTH, 'v');
+  ASSERT_TRUE(tableGet(&table, copyString(text.c_str(), (int)text.size()), &value));
+  ASSERT_FALSE(tableSet(&table, again, NUMBER_VAL(2)));
+  ASSERT_TRUE(tableGet(&table, key, &value));
+  ASSERT_EQ(2, AS_NUMBER(value));
+  ASSERT_TRUE(tableDelete(&table, again));
+  ASSERT_EQ(0, table.count);
+
+  pop();
+  pop();
+  freeTable(&table);
+}
@@ -0,0 +1,68 @@
+#include "profile.h"
+
+#ifdef DEBUG_PROFILE
+
+#include "vm.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+/**
+ * The line of `report` that starts with `prefix`, or "" if there is none.
+ */
+static std::string
+reportLine(const std::string& report, const std::string& prefix) {
+  size_t start = 0;
+  while (start < report.size()) {
+    size_t end = report.find('\n', start);
+    if (end == std::string::npos) {
+      end = report.size();
+    }
+    if (report.compare(start, prefix.size(), prefix) == 0) {
+      return report.substr(start, end - start);
+    }
+    start = end + 1;
+  }
+  return "";
+}
+
+TEST(ProfileTest, ReportTC) {
+  initVM();
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret("fun profiledAdd(a, b) {\n"
+                                                     "  return a + b;\n"
+                                                     "}\n"
+                                                     "var x = 0;\n"
+                                                     "for (var i = 0; i < 100; i = i + 1) {\n"
+                                                     "  x = profiledAdd(x, i);\n"
+                                                     "}\n"));
+
+  FILE* out = tmpfile();
+  profileReport(out);
+  std::string report(ftell(out), '\0');
+  rewind(out);
+  ASSERT_EQ(report.size(), fread(&(report[0]), 1, report.size(), out));
+  fclose(out);
+  freeVM();
+
+  // NOTE: the opcode counters add up over every VM of the test run, so only their presence is checked
+  ASSERT_NE(std::string::npos, report.find("== profile: opcodes ==\n"));
+  ASSERT_NE("", reportLine(report, "OP_ADD "));
+  ASSERT_NE(std::string::npos, report.find("== profile: functions ==\n"));
+  ASSERT_NE(std::string::npos, report.find("== profile: lines (top 20) ==\n"));
+
+  // Each call runs two loads, the addition and the return on line 2.
+  char name[32];
+  unsigned long long instructions = 0;
+  ASSERT_EQ(2, sscanf(reportLine(report, "profiledAdd ").c_str(), "%31s %llu", name, &instructions));
+  ASSERT_EQ(400u, instructions);
+  int line = 0;
+  const std::string lines = report.substr(report.find("== profile: lines"));
+  ASSERT_EQ(3, sscanf(reportLine(lines, "profiledAdd ").c_str(), "%31s %d %llu", name, &line, &instructions));
+  ASSERT_EQ(2, line);
+  ASSERT_EQ(400u, instructions);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "sampler.h"
+
+#include "vm.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+
+/**
+ * spin() in a test script: burn CPU time, so the profiling timer fires while the caller is on the stack. Half-way
+ * through it drains what was sampled so far, the way a collection would.
+ */
+static bool
+spinNative(int argCount, Value* args, Value* result) {
+  for (int half = 0; half < 2; half++) {
+    const clock_t start = clock();
+    volatile double sink = 0;
+    while (clock() - start < CLOCKS_PER_SEC / 10) {
+      sink = sink + 1;
+    }
+    drainSamples();
+  }
+  return true;
+}
+
+TEST(SamplerTest, FoldedStacksTC) {
+  initVM();
+  const NativeDef natives[] = {{"spin", spinNative, 0, 0}};
+  defineNatives(&(vm.globals), natives, 1);
+  char path[] = "/tmp/samplerTestXXXXXX";
+  close(mkstemp(path));
+
+  ASSERT_TRUE(startSampling(path, 1000));
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret("fun outer() {\n"
+                                                     "  spin();\n"
+                                                     "}\n"
+                                                     "outer();\n"));
+  stopSampling();
+  freeVM();
+
+  // Every line is a stack of "function:line" frames, outermost first, and the number of samples taken in it.
+  std::map<std::string, unsigned long long> counts;
+  FILE* file = fopen(path, "r");
+  ASSERT_NE(nullptr, file);
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    char* space = strrchr(line, ' ');
+    ASSERT_NE(nullptr, space);
+    *space = '\0';
+    ASSERT_EQ(0u, counts.count(line));
+    counts[line] = strtoull(space + 1, nullptr, 10);
+  }
+  fclose(file);
+  unlink(path);
+
+  // Both halves of the spin were counted under one stack; the timer ticks every millisecond of CPU time.
+  ASSERT_EQ(1u, counts.count("script:4;outer:2"));
+  ASSERT_LE(20u, counts["script:4;outer:2"]);
+}
+
+#endif
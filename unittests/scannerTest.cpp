@@ -0,0 +1,78 @@
+#include "scanner.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+static void
+expectToken(TokenType type, const char* text, int line) {
+  Token token = scanToken();
+  ASSERT_EQ(tokenTypeToInt(type), tokenTypeToInt(token.type));
+  ASSERT_EQ((int)strlen(text), token.length);
+  ASSERT_EQ(0, memcmp(text, token.start, token.length));
+  ASSERT_EQ(line, token.line);
+}
+
+TEST(ScannerTest, KeywordsTC) {
+  initScanner("and class else false for fun if nil or print return super this true var while");
+  expectToken(TokenType::TOKEN_AND, "and", 1);
+  expectToken(TokenType::TOKEN_CLASS, "class", 1);
+  expectToken(TokenType::TOKEN_ELSE, "else", 1);
+  expectToken(TokenType::TOKEN_FALSE, "false", 1);
+  expectToken(TokenType::TOKEN_FOR, "for", 1);
+  expectToken(TokenType::TOKEN_FUN, "fun", 1);
+  expectToken(TokenType::TOKEN_IF, "if", 1);
+  expectToken(TokenType::TOKEN_NIL, "nil", 1);
+  expectToken(TokenType::TOKEN_OR, "or", 1);
+  expectToken(TokenType::TOKEN_PRINT, "print", 1);
+  expectToken(TokenType::TOKEN_RETURN, "return", 1);
+  expectToken(TokenType::TOKEN_SUPER, "super", 1);
+  expectToken(TokenType::TOKEN_THIS, "this", 1);
+  expectToken(TokenType::TOKEN_TRUE, "true", 1);
+  expectToken(TokenType::TOKEN_VAR, "var", 1);
+  expectToken(TokenType::TOKEN_WHILE, "while", 1);
+  expectToken(TokenType::TOKEN_EOF, "", 1);
+}
+
+TEST(ScannerTest, SubscriptTC) {
+  initScanner("xs[0] = [1, 2];");
+  expectToken(TokenType::TOKEN_IDENTIFIER, "xs", 1);
+  expectToken(TokenType::TOKEN_LEFT_BRACKET, "[", 1);
+  expectToken(TokenType::TOKEN_NUMBER, "0", 1);
+  expectToken(TokenType::TOKEN_RIGHT_BRACKET, "]", 1);
+  expectToken(TokenType::TOKEN_EQUAL, "=", 1);
+  expectToken(TokenType::TOKEN_LEFT_BRACKET, "[", 1);
+  expectToken(TokenType::TOKEN_NUMBER, "1", 1);
+  expectToken(TokenType::TOKEN_COMMA, ",", 1);
+  expectToken(TokenType::TOKEN_NUMBER, "2", 1);
+  expectToken(TokenType::TOKEN_RIGHT_BRACKET, "]", 1);
+  expectToken(TokenType::TOKEN_SEMICOLON, ";", 1);
+  expectToken(TokenType::TOKEN_EOF, "", 1);
+}
+
+TEST(ScannerTest, NearKeywordsTC) {
+  initScanner("an classy f fo funny i nil_ orr thi _while");
+  for (int i = 0; i < 10; i++) {
+    Token token = scanToken();
+    ASSERT_EQ(tokenTypeToInt(TokenType::TOKEN_IDENTIFIER), tokenTypeToInt(token.type));
+  }
+  expectToken(TokenType::TOKEN_EOF, "", 1);
+}
+
+TEST(ScannerTest, LongTokensTC) {
+  initScanner("   \t\r\n    // a comment that spans more than one block of sixteen bytes\n"
+              "an_identifier_longer_than_thirty_two_bytes_Z9 1234567890123456789.0123456789012345\n"
+              "\"a string\nliteral spanning several blocks and a couple of lines\n\" x");
+  expectToken(TokenType::TOKEN_IDENTIFIER, "an_identifier_longer_than_thirty_two_bytes_Z9", 3);
+  expectToken(TokenType::TOKEN_NUMBER, "1234567890123456789.0123456789012345", 3);
+  expectToken(TokenType::TOKEN_STRING, "\"a string\nliteral spanning several blocks and a couple of lines\n\"", 6);
+  expectToken(TokenType::TOKEN_IDENTIFIER, "x", 6);
+  expectToken(TokenType::TOKEN_EOF, "", 6);
+}
+
+TEST(ScannerTest, UnterminatedStringTC) {
+  initScanner("\"never closed\n");
+  Token token = scanToken();
+  ASSERT_EQ(tokenTypeToInt(TokenType::TOKEN_ERROR), tokenTypeToInt(token.type));
+  expectToken(TokenType::TOKEN_EOF, "", 2);
+}
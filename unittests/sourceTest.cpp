@@ -0,0 +1,98 @@
+#include "source.h"
+
+#include "lims.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+static const SourceKind FILE_KIND = SourceKind::SOURCE_MAPPED;
+#else
+static const SourceKind FILE_KIND = SourceKind::SOURCE_HEAP;
+#endif
+
+/**
+ * Write `text` to a new temporary file and return its path.
+ */
+static std::string
+writeTemp(const std::string& text) {
+  char path[] = "/tmp/sourceTestXXXXXX";
+  const int fd = mkstemp(path);
+  EXPECT_LE(0, fd);
+  EXPECT_EQ((ssize_t)text.size(), write(fd, text.data(), text.size()));
+  close(fd);
+  return path;
+}
+
+/**
+ * Open `text` as a file; its characters must come back with the '\0' sentinel behind them.
+ */
+static void
+expectFile(const std::string& text) {
+  const std::string path = writeTemp(text);
+  Source source;
+  ASSERT_TRUE(openSourceFile(&source, path.c_str()));
+  unlink(path.c_str());
+
+  ASSERT_EQ(FILE_KIND, source.kind);
+  ASSERT_EQ(text.size(), source.length);
+  ASSERT_EQ(0, memcmp(text.data(), source.chars, text.size()));
+  ASSERT_EQ('\0', source.chars[source.length]);
+  ASSERT_LT(source.length, source.reserved);
+  closeSource(&source);
+  ASSERT_EQ(SourceKind::SOURCE_NONE, source.kind);
+  ASSERT_EQ(nullptr, source.chars);
+}
+
+TEST(SourceTest, FileTC) {
+  expectFile("print 1;\n");
+}
+
+TEST(SourceTest, EmptyFileTC) {
+  expectFile("");
+}
+
+TEST(SourceTest, PageTailTC) {
+  // The sentinel is the zero-filled tail of the last page, or a spare page behind a file that fills its pages.
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  expectFile(std::string(page - 1, 'a'));
+  expectFile(std::string(page, 'b'));
+  expectFile(std::string(3 * page, 'c'));
+}
+
+TEST(SourceTest, MissingFileTC) {
+  Source source;
+  ASSERT_FALSE(openSourceFile(&source, "/nonexistent/source.lox"));
+  ASSERT_FALSE(openSourceFile(&source, "/tmp"));
+  ASSERT_EQ(SourceKind::SOURCE_NONE, source.kind);
+}
+
+TEST(SourceTest, StreamTC) {
+  // More than one refill's worth, so the text arrives in blocks.
+  std::string text;
+  while (text.size() <= 2 * lims::SOURCE_STREAM_BLOCK) {
+    text += "var x = \"some text\";\n";
+  }
+  FILE* file = tmpfile();
+  fputs(text.c_str(), file);
+  rewind(file);
+
+  Source source;
+  ASSERT_TRUE(openSourceStream(&source, file));
+  const char* chars = source.chars;
+  while (refillSource(&source)) {
+    ASSERT_EQ('\0', source.chars[source.length]);
+  }
+  ASSERT_EQ(chars, source.chars);
+  ASSERT_EQ(text.size(), source.length);
+  ASSERT_EQ(0, memcmp(text.data(), source.chars, text.size()));
+  ASSERT_EQ('\0', source.chars[source.length]);
+  ASSERT_FALSE(refillSource(&source));
+  closeSource(&source);
+  fclose(file);
+}
@@ -0,0 +1,222 @@
+#include "table.h"
+
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+class TableTest : public testing::Test {
+protected:
+  void
+  SetUp() override {
+    initVM();
+    initTable(&table);
+    for (int i = 0; i < KEY_COUNT; i++) {
+      char name[16];
+      int length = snprintf(name, sizeof(name), "key%d", i);
+      keys[i] = copyString(name, length);
+    }
+  }
+
+  void
+  TearDown() override {
+    freeTable(&table);
+    freeVM();
+  }
+
+  static constexpr int KEY_COUNT = 1000;
+  Table table;
+  ObjString* keys[KEY_COUNT];
+};
+
+TEST_F(TableTest, SetGetTC) {
+  for (int i = 0; i < KEY_COUNT; i++) {
+    ASSERT_TRUE(tableSet(&table, keys[i], NUMBER_VAL(i)));
+  }
+  ASSERT_FALSE(tableSet(&table, keys[7], NUMBER_VAL(-7)));
+
+  for (int i = 0; i < KEY_COUNT; i++) {
+    Value value;
+    ASSERT_TRUE(tableGet(&table, keys[i], &value));
+    ASSERT_EQ(i == 7 ? -7 : i, AS_NUMBER(value));
+  }
+}
+
+TEST_F(TableTest, DeleteTC) {
+  for (int i = 0; i < KEY_COUNT; i++) {
+    tableSet(&table, keys[i], NUMBER_VAL(i));
+  }
+  for (int i = 0; i < KEY_COUNT; i += 2) {
+    ASSERT_TRUE(tableDelete(&table, keys[i]));
+  }
+  ASSERT_FALSE(tableDelete(&table, keys[0]));
+
+  for (int i = 0; i < KEY_COUNT; i++) {
+    Value value;
+    ASSERT_EQ(i % 2 == 1, tableGet(&table, keys[i], &value));
+  }
+
+  // Deleted slots are reused.
+  for (int i = 0; i < KEY_COUNT; i += 2) {
+    ASSERT_TRUE(tableSet(&table, keys[i], NUMBER_VAL(i)));
+  }
+  for (int i = 0; i < KEY_COUNT; i++) {
+    Value value;
+    ASSERT_TRUE(tableGet(&table, keys[i], &value));
+    ASSERT_EQ(i, AS_NUMBER(value));
+  }
+}
+
+TEST_F(TableTest, FindStringTC) {
+  ObjString* found = tableFindString(&(vm.strings), "key42", 5, keys[42]->hash);
+  ASSERT_EQ(keys[42], found);
+  ASSERT_EQ(nullptr, tableFindString(&(vm.strings), "nope", 4, 12345));
+}
+
+static ObjString*
+runtimeString(const char* text) {
+  const int length = (int)strlen(text);
+  char* chars = ALLOCATE(char, length + 1);
+  memcpy(chars, text, length + 1);
+  return takeString(chars, length);
+}
+
+TEST_F(TableTest, RuntimeKeyTC) {
+  tableSet(&table, keys[5], NUMBER_VAL(5));
+
+  ObjString* key5 = runtimeString("key5");
+  ASSERT_FALSE(key5->interned);
+  Value value;
+  ASSERT_TRUE(tableGet(&table, key5, &value));
+  ASSERT_EQ(5, AS_NUMBER(value));
+  ASSERT_FALSE(key5->interned);
+  // The hash computed for the lookup is kept for the next one.
+  ASSERT_EQ(keys[5]->hash, key5->hash);
+
+  // Looking a key up does not intern it; storing one does.
+  ObjString* fresh = runtimeString("fresh");
+  ASSERT_FALSE(tableGet(&table, fresh, &value));
+  ASSERT_FALSE(fresh->interned);
+  ASSERT_TRUE(tableSet(&table, fresh, NUMBER_VAL(1)));
+  ASSERT_TRUE(fresh->interned);
+  ASSERT_EQ(fresh, tableFindString(&(vm.strings), "fresh", 5, fresh->hash));
+
+  ASSERT_TRUE(tableGet(&table, runtimeString("fresh"), &value));
+  ASSERT_EQ(1, AS_NUMBER(value));
+  ASSERT_TRUE(tableDelete(&table, runtimeString("fresh")));
+}
+
+TEST_F(TableTest, ShrinkTC) {
+  for (int i = 0; i < KEY_COUNT; i++) {
+    tableSet(&table, keys[i], NUMBER_VAL(i));
+  }
+  const int fullCapacity = table.capacity;
+
+  for (int i = 10; i < KEY_COUNT - 1; i++) {
+    tableDelete(&table, keys[i]);
+  }
+  tableSet(&table, keys[KEY_COUNT - 1], NIL_VAL);
+  ASSERT_EQ(fullCapacity, table.capacity);
+
+  // The next new key finds the table mostly empty.
+  tableDelete(&table, keys[KEY_COUNT - 1]);
+  tableSet(&table, keys[KEY_COUNT - 1], NIL_VAL);
+  ASSERT_LT(table.capacity, fullCapacity);
+  ASSERT_EQ(0, table.tombstones);
+  ASSERT_EQ(11, table.count);
+
+  for (int i = 0; i < 10; i++) {
+    Value value;
+    ASSERT_TRUE(tableGet(&table, keys[i], &value));
+    ASSERT_EQ(i, AS_NUMBER(value));
+  }
+}
+
+TEST_F(TableTest, ChurnTC) {
+  for (int i = 0; i < 100; i++) {
+    tableSet(&table, keys[i], NUMBER_VAL(i));
+  }
+  const int capacity = table.capacity;
+
+  // Replacing keys leaves tombstones behind; they must not make the table grow.
+  for (int round = 0; round < 50; round++) {
+    for (int i = 0; i < 100; i++) {
+      const int out = (round * 100 + i) % KEY_COUNT;
+      const int in = (round * 100 + i + 100) % KEY_COUNT;
+      ASSERT_TRUE(tableDelete(&table, keys[out]));
+      ASSERT_TRUE(tableSet(&table, keys[in], NUMBER_VAL(in)));
+    }
+  }
+  ASSERT_EQ(capacity, table.capacity);
+  ASSERT_EQ(100, table.count);
+
+  for (int i = 0; i < 100; i++) {
+    const int key = (5000 + i) % KEY_COUNT;
+    Value value;
+    ASSERT_TRUE(tableGet(&table, keys[key], &value));
+    ASSERT_EQ(key, AS_NUMBER(value));
+  }
+}
+
+TEST_F(TableTest, ValueKeysTC) {
+  ValueTable values;
+  initValueTable(&values);
+
+  for (int i = 0; i < KEY_COUNT; i++) {
+    ASSERT_TRUE(valueTableSet(&values, NUMBER_VAL(i), NUMBER_VAL(i * 2)));
+  }
+  ASSERT_TRUE(valueTableSet(&values, OBJ_VAL(keys[3]), NUMBER_VAL(-3)));
+  ASSERT_TRUE(valueTableSet(&values, NIL_VAL, BOOL_VAL(true)));
+
+  Value value;
+  for (int i = 0; i < KEY_COUNT; i++) {
+    ASSERT_TRUE(valueTableGet(&values, NUMBER_VAL(i), &value));
+    ASSERT_EQ(i * 2, AS_NUMBER(value));
+  }
+  ASSERT_TRUE(valueTableGet(&values, OBJ_VAL(runtimeString("key3")), &value));
+  ASSERT_EQ(-3, AS_NUMBER(value));
+  ASSERT_TRUE(valueTableGet(&values, NIL_VAL, &value));
+  ASSERT_FALSE(valueTableGet(&values, NUMBER_VAL(0.5), &value));
+  ASSERT_FALSE(valueTableGet(&values, OBJ_VAL(keys[4]), &value));
+
+  // -0 is the same key as 0, and every NaN is the same key.
+  ASSERT_FALSE(valueTableSet(&values, NUMBER_VAL(-0.0), NUMBER_VAL(42)));
+  ASSERT_TRUE(valueTableGet(&values, NUMBER_VAL(0), &value));
+  ASSERT_EQ(42, AS_NUMBER(value));
+  ASSERT_TRUE(valueTableSet(&values, NUMBER_VAL(NAN), NUMBER_VAL(1)));
+  ASSERT_FALSE(valueTableSet(&values, NUMBER_VAL(-NAN), NUMBER_VAL(2)));
+
+  for (int i = 0; i < KEY_COUNT; i += 2) {
+    ASSERT_TRUE(valueTableDelete(&values, NUMBER_VAL(i)));
+  }
+  ASSERT_EQ(KEY_COUNT / 2 + 3, values.count);
+
+  freeValueTable(&values);
+}
+
+TEST_F(TableTest, RemoveWhiteShrinkTC) {
+  ObjList* strings = newList();
+  push(OBJ_VAL(strings));
+  for (int i = 0; i < 20000; i++) {
+    char name[16];
+    int length = snprintf(name, sizeof(name), "dead%d", i);
+    strings->items.push(OBJ_VAL(copyString(name, length)));
+  }
+  ObjString* kept = copyString("kept", 4);
+  push(OBJ_VAL(kept));
+  const int capacity = vm.strings.capacity;
+
+  // Once the strings are unreachable, a collection must give most of vm.strings back.
+  strings->items.count = 0;
+  collectGarbage();
+  ASSERT_LT(vm.strings.capacity, capacity / 16);
+  ASSERT_EQ(kept, tableFindString(&vm.strings, "kept", 4, hashString("kept", 4)));
+  ASSERT_EQ(nullptr, tableFindString(&vm.strings, "dead7", 5, hashString("dead7", 5)));
+  pop();
+  pop();
+}
@@ -0,0 +1,488 @@
+#include "vm.h"
+
+#include "object.h"
+#include "source.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+static int checksPassed;
+static int checksFailed;
+
+/**
+ * check(actual, expected) in a test script.
+ */
+static bool
+checkNative(int argCount, Value* args, Value* result) {
+  if (valuesEqual(args[0], args[1])) {
+    checksPassed += 1;
+    return true;
+  }
+  checksFailed += 1;
+  printf("check failed: got ");
+  printValue(args[0]);
+  printf(", expected ");
+  printValue(args[1]);
+  printf("\n");
+  return true;
+}
+
+class VMTest : public testing::Test {
+protected:
+  void
+  SetUp() override {
+    initVM();
+    const NativeDef natives[] = {{"check", checkNative, 2, 2}};
+    defineNatives(&(vm.globals), natives, 1);
+    checksPassed = 0;
+    checksFailed = 0;
+  }
+
+  void
+  TearDown() override {
+    freeVM();
+  }
+
+  /**
+   * Run `text` the way a script file is run, with top-level bodies compiled on their first call.
+   */
+  static InterpretResult
+  interpretFile(const char* text) {
+    FILE* file = tmpfile();
+    fputs(text, file);
+    rewind(file);
+    Source source;
+    if (!openSourceStream(&source, file)) {
+      fclose(file);
+      return InterpretResult::INTERPRET_COMPILE_ERROR;
+    }
+    const InterpretResult result = interpret(&source);
+    closeSource(&source);
+    fclose(file);
+    return result;
+  }
+
+  /**
+   * Run a script made of check() calls: it must finish and every check must pass.
+   */
+  static void
+  expectChecks(const char* text) {
+    ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret(text));
+    ASSERT_EQ(0, checksFailed);
+    ASSERT_LT(0, checksPassed);
+  }
+};
+
+static Value recorded;
+
+static bool
+recordNative(int argCount, Value* args, Value* result) {
+  recorded = args[0];
+  return true;
+}
+
+static bool
+sumNative(int argCount, Value* args, Value* result) {
+  double sum = 0;
+  for (int i = 0; i < argCount; i++) {
+    if (!IS_NUMBER(args[i])) {
+      return nativeError("sum() takes numbers.");
+    }
+    sum += AS_NUMBER(args[i]);
+  }
+  *result = NUMBER_VAL(sum);
+  return true;
+}
+
+static bool
+rangeNative(int argCount, Value* args, Value* result) {
+  // Every push may collect; the list is safe in `*result`.
+  ObjList* list = newList();
+  *result = OBJ_VAL(list);
+  for (int i = 0; i < (int)AS_NUMBER(args[0]); i++) {
+    list->items.push(NUMBER_VAL(i));
+    copyString("garbage", 7);
+    collectGarbage();
+  }
+  return true;
+}
+
+TEST_F(VMTest, NativesTC) {
+  const NativeDef natives[] = {
+      {"record", recordNative, 1, 1},
+      {"sum", sumNative, 1, NATIVE_VARIADIC},
+      {"range", rangeNative, 1, 1},
+  };
+  defineNatives(&(vm.globals), natives, 3);
+
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret("record(sum(1, 2, 3));"));
+  ASSERT_EQ(6, AS_NUMBER(recorded));
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret("record(range(50));"));
+  ASSERT_EQ(50, AS_LIST(recorded)->items.count);
+  ASSERT_EQ(49, AS_NUMBER(AS_LIST(recorded)->items[49]));
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret("record([1, 2].slice(1).len());"));
+  ASSERT_EQ(1, AS_NUMBER(recorded));
+
+  // Arity is checked before the call, errors raised by the native stop the script.
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpret("record(1, 2);"));
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpret("sum();"));
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpret("[].len(1);"));
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpret("record(sum(1, \"2\")); record(nil);"));
+  ASSERT_EQ(1, AS_NUMBER(recorded));
+  ASSERT_EQ(vm.stack.bottom(), vm.stack.top());
+}
+
+TEST_F(VMTest, DeferredBodiesTC) {
+  // Bodies of top-level functions and methods compile on the first call, and only the called ones.
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpretFile("fun add(a, b) { return a + b; }\n"
+                                                          "fun unused(x) { return x * 2; }\n"
+                                                          "class Counter {\n"
+                                                          "  init(n) { this.n = n; }\n"
+                                                          "  bump() { this.n = this.n + 1; return this; }\n"
+                                                          "}\n"
+                                                          "check(add(1, 2), 3);\n"
+                                                          "check(Counter(5).bump().bump().n, 7);\n"));
+  ASSERT_EQ(0, checksFailed);
+  ASSERT_EQ(2, checksPassed);
+
+  // The arity is known before the body is compiled.
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpretFile("fun f(a, b) { return a; }\nf(1);\n"));
+}
+
+TEST_F(VMTest, DeferredBodyOutlivesSourceTC) {
+  // The source is closed once the script has run; the bodies it deferred still compile when they are called later.
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpretFile("fun later(a) { return a + \"!\"; }\n"
+                                                          "fun outer() { fun inner() { return \"in\"; } return inner; }\n"
+                                                          "class Box { get() { return \"box\"; } }\n"));
+  expectChecks("check(later(\"late\"), \"late!\");\n"
+               "check(outer()(), \"in\");\n"
+               "check(Box().get(), \"box\");\n");
+  ASSERT_EQ(3, checksPassed);
+}
+
+TEST_F(VMTest, DeferredBodyErrorsTC) {
+  // Errors in a deferred body are reported when it is first called; a body that is never called is never compiled.
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpretFile("fun bad() { var = ; }\ncheck(1, 1);\n"));
+  ASSERT_EQ(1, checksPassed);
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpretFile("fun bad() { var = ; }\nbad();\ncheck(1, 1);\n"));
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR,
+            interpretFile("class A { m() { return 1 +; } }\nA().m();\ncheck(1, 1);\n"));
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpretFile("fun f() { this.x = 1; }\nf();\n"));
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpretFile("class A { init() { return 1; } }\nA();\n"));
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR,
+            interpretFile("fun f() { { var a = 1; var a = 2; } }\nf();\n"));
+  ASSERT_EQ(1, checksPassed);
+
+  // The braces are matched up front, so an unclosed body is still an error at load time.
+  ASSERT_EQ(InterpretResult::INTERPRET_COMPILE_ERROR, interpretFile("fun f() { if (true) { print 1; }\n"));
+  ASSERT_EQ(InterpretResult::INTERPRET_COMPILE_ERROR, interpretFile("fun f(a b) { }\n"));
+}
+
+TEST_F(VMTest, ListsTC) {
+  expectChecks("var xs = [1, \"two\", nil];\n"
+               "check(xs.len(), 3);\n"
+               "check(xs[1], \"two\");\n"
+               "check(xs[2], nil);\n"
+               "xs[2] = 3;\n"
+               "check(xs[2], 3);\n"
+               "check(xs[0] = 5, 5);\n"
+               "check([].len(), 0);\n"
+               "check([[1, 2], [3]][1][0], 3);\n"
+               "check(xs.push(4, 5), 5);\n"
+               "check(xs.pop(), 5);\n"
+               "check(xs.len(), 4);\n"
+               "check([].pop(), nil);\n"
+               "var s = [0, 1, 2, 3, 4];\n"
+               "check(s.slice().len(), 5);\n"
+               "check(s.slice(1, 3)[0], 1);\n"
+               "check(s.slice(1, 3).len(), 2);\n"
+               "check(s.slice(-2)[0], 3);\n"
+               "check(s.slice(-2).len(), 2);\n"
+               "check(s.slice(-10, -4).len(), 1);\n"
+               "check(s.slice(3, 1).len(), 0);\n"
+               "check(s.slice(2, 100).len(), 3);\n"
+               "check(s.slice(0/0).len(), 5);\n"
+               "check(s.slice(0/0, 0/0).len(), 5);\n"
+               "check(s.slice(1, 0/0).len(), 4);\n"
+               "check(s.slice(\"a\", nil).len(), 5);\n");
+
+  const char* errors[] = {
+      "[1][1];",
+      "[1][-1];",
+      "[1][0.5];",
+      "[1][0/0];",
+      "[1][\"0\"];",
+      "var a = [1]; a[1] = 2;",
+      "var a = [1]; a[0/0] = 2;",
+      "nil[0];",
+  };
+  for (const char* source : errors) {
+    ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpret(source)) << source;
+  }
+}
+
+TEST_F(VMTest, PrintCyclesTC) {
+  testing::internal::CaptureStdout();
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret("var xs = [1]; xs.push(xs); print xs;\n"
+                                                     "var ys = [xs, xs]; print ys;\n"));
+  const std::string output = testing::internal::GetCapturedStdout();
+  ASSERT_NE(std::string::npos, output.find("[1, [...]]\n"));
+  ASSERT_NE(std::string::npos, output.find("[[1, [...]], [1, [...]]]\n"));
+}
+
+TEST_F(VMTest, MapsTC) {
+  expectChecks("var m = {1: \"one\", \"two\": 2, nil: false};\n"
+               "check(m.len(), 3);\n"
+               "check(m[1], \"one\");\n"
+               "check(m[\"two\"], 2);\n"
+               "check(m[nil], false);\n"
+               "check(m[\"missing\"], nil);\n"
+               "check(m[\"tw\" + \"o\"], 2);\n"
+               "check(m[1] = \"uno\", \"uno\");\n"
+               "check(m[1], \"uno\");\n"
+               "check(m[\"1\"], nil);\n"
+               "check({}.len(), 0);\n"
+               // Objects are keys by identity.
+               "class K {}\n"
+               "var a = K(); var b = K();\n"
+               "m[a] = \"a\";\n"
+               "check(m[a], \"a\");\n"
+               "check(m[b], nil);\n"
+               "var l = [1];\n"
+               "m[l] = \"list\";\n"
+               "check(m[[1]], nil);\n"
+               "check(m[l], \"list\");\n"
+               // -0 is the key 0, and every NaN is the same key.
+               "var z = {};\n"
+               "z[-0] = \"zero\";\n"
+               "check(z[0], \"zero\");\n"
+               "z[0] = \"again\";\n"
+               "check(z.len(), 1);\n"
+               "z[0/0] = \"nan\";\n"
+               "check(z[0/0], \"nan\");\n"
+               "check(z[-(0/0)], \"nan\");\n"
+               "check(z.len(), 2);\n"
+               // Methods.
+               "check(m.has(a), true);\n"
+               "check(m.has(b), false);\n"
+               "check(m.remove(a), true);\n"
+               "check(m.remove(a), false);\n"
+               "check(m.has(a), false);\n"
+               "check(m.keys().len(), m.len());\n"
+               "var keys = {\"x\": 1, \"y\": 2}.keys();\n"
+               "check(keys.len(), 2);\n"
+               "check(keys[0] == \"x\" or keys[1] == \"x\", true);\n");
+}
+
+TEST_F(VMTest, PrintMapCyclesTC) {
+  testing::internal::CaptureStdout();
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret("var m = {}; m[1] = m; print m;\n"
+                                                     "var xs = [m]; m[2] = xs; print xs;\n"));
+  const std::string output = testing::internal::GetCapturedStdout();
+  ASSERT_NE(std::string::npos, output.find("{1: {...}}\n"));
+  ASSERT_EQ(true, output.find("[{1: {...}, 2: [...]}]\n") != std::string::npos ||
+                      output.find("[{2: [...], 1: {...}}]\n") != std::string::npos);
+}
+
+TEST_F(VMTest, Float64ArrayLengthTC) {
+  expectChecks("check(Float64Array(0).len(), 0);\n"
+               "check(Float64Array(3).len(), 3);\n"
+               "check(Float64Array([1, 2]).sum(), 3);\n");
+
+  const char* errors[] = {
+      "Float64Array(0/0);",
+      "Float64Array(-1);",
+      "Float64Array(1.5);",
+      "Float64Array(1/0);",
+      "Float64Array(-1/0);",
+  };
+  for (const char* source : errors) {
+    ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR, interpret(source)) << source;
+  }
+}
+
+TEST_F(VMTest, CapturedValuesTC) {
+  // A capture that is assigned after the closure is made still sees the new value, whoever assigns it.
+  expectChecks("fun later() { var x = 1; fun get() { return x; } x = 2; return get; }\n"
+               "check(later()(), 2);\n"
+               "fun other() {\n"
+               "  var x = \"before\";\n"
+               "  fun get() { return x; }\n"
+               "  fun set() { x = \"after\"; }\n"
+               "  set();\n"
+               "  return get;\n"
+               "}\n"
+               "check(other()(), \"after\");\n"
+               "fun counter() { var n = 0; fun inc() { n = n + 1; return n; } return inc; }\n"
+               "var c1 = counter();\n"
+               "var c2 = counter();\n"
+               "c1(); c1();\n"
+               "check(c1(), 3);\n"
+               "check(c2(), 1);\n");
+
+  // Writes through an upvalue of an upvalue.
+  expectChecks("fun outer() {\n"
+               "  var a = 1;\n"
+               "  fun middle() { fun inner() { a = a + 10; return a; } return inner; }\n"
+               "  var inner = middle();\n"
+               "  inner();\n"
+               "  check(a, 11);\n"
+               "  a = 100;\n"
+               "  return inner;\n"
+               "}\n"
+               "check(outer()(), 110);\n");
+
+  // Parameters and recursive local functions.
+  expectChecks("fun param(p) { fun get() { return p; } p = p + 1; return get; }\n"
+               "check(param(1)(), 2);\n"
+               "fun adder(n) { fun add(x) { return x + n; } return add; }\n"
+               "check(adder(3)(4), 7);\n"
+               "fun outerRec() { fun fact(n) { if (n < 2) return 1; return n * fact(n - 1); } return fact; }\n"
+               "check(outerRec()(5), 120);\n");
+
+  // A slot used by a captured local is reused by one in a sibling scope, which is assigned after capture.
+  expectChecks("var first;\n"
+               "var second;\n"
+               "fun scopes() {\n"
+               "  { var a = \"a\"; fun get() { return a; } first = get; }\n"
+               "  { var b = \"b\"; fun get() { return b; } second = get; b = \"b2\"; }\n"
+               "}\n"
+               "scopes();\n"
+               "check(first(), \"a\");\n"
+               "check(second(), \"b2\");\n"
+               "var fns = [];\n"
+               "for (var i = 0; i < 3; i = i + 1) { var j = i * 10; fun show() { return j; } fns.push(show); }\n"
+               "check(fns[0](), 0);\n"
+               "check(fns[2](), 20);\n");
+
+  // Methods capture `this`, and closures in them can reach `super`.
+  expectChecks("class Base { hello() { return \"base\"; } }\n"
+               "class Derived < Base {\n"
+               "  init(name) { this.name = name; }\n"
+               "  greeter() { fun greet() { return this.name; } return greet; }\n"
+               "  hello() { fun viaSuper() { return super.hello() + \"!\"; } return viaSuper; }\n"
+               "}\n"
+               "var d = Derived(\"bob\");\n"
+               "var greet = d.greeter();\n"
+               "d.name = \"rob\";\n"
+               "check(greet(), \"rob\");\n"
+               "check(d.hello()(), \"base!\");\n");
+}
+
+TEST_F(VMTest, SharedClosuresTC) {
+  // A declaration that captures nothing makes one closure, a declaration that captures makes one per run.
+  expectChecks("fun plain() { fun twice(x) { return x * 2; } return twice; }\n"
+               "check(plain() == plain(), true);\n"
+               "check(plain()(21), 42);\n"
+               "fun capturing(n) { fun add(x) { return x + n; } return add; }\n"
+               "check(capturing(1) == capturing(1), false);\n");
+}
+
+/**
+ * True when no upvalue is open, in the slot array and in its bitmap.
+ */
+static bool
+noOpenUpvalues() {
+  for (int slot = 0; slot < lims::STACK_MAX; slot++) {
+    if (vm.openUpvalues[slot] != nullptr || (vm.openSlots[slot >> 6] & (uint64_t{1} << (slot & 63))) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST_F(VMTest, OpenUpvaluesTC) {
+  // Locals on both sides of a bitmap word boundary, captured and assigned after capture so they stay open.
+  std::string source = "fun wide() {\n  var low = 1;\n";
+  for (int i = 0; i < 70; i++) {
+    source += "  var pad" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+  }
+  source += "  var high = 2;\n"
+            "  fun get() { return low * 10 + high; }\n"
+            "  low = 3;\n"
+            "  high = 4;\n"
+            "  check(get(), 34);\n"
+            "  return get;\n"
+            "}\n"
+            "var get = wide();\n"
+            "check(get(), 34);\n";
+  expectChecks(source.c_str());
+  ASSERT_TRUE(noOpenUpvalues());
+
+  // Two closures of one slot share its upvalue, open and closed.
+  expectChecks("var get;\n"
+               "var set;\n"
+               "fun pair() {\n"
+               "  var x = 1;\n"
+               "  fun g() { return x; }\n"
+               "  fun s(v) { x = v; }\n"
+               "  get = g;\n"
+               "  set = s;\n"
+               "  set(2);\n"
+               "  check(get(), 2);\n"
+               "  check(x, 2);\n"
+               "}\n"
+               "pair();\n"
+               "set(3);\n"
+               "check(get(), 3);\n");
+  ASSERT_TRUE(noOpenUpvalues());
+
+  // A runtime error leaves no upvalue open, and the next script captures the same slots afresh.
+  ASSERT_EQ(InterpretResult::INTERPRET_RUNTIME_ERROR,
+            interpret("fun f() { var x = 1; fun g() { return x; } x = 2; return nil + g; }\nf();\n"));
+  ASSERT_TRUE(noOpenUpvalues());
+  expectChecks("fun f() { var x = 1; fun g() { return x; } x = 5; return g; }\ncheck(f()(), 5);\n");
+}
+
+/**
+ * Objects of `type` in the heap, dead or alive, since the last collection.
+ */
+static size_t
+objectsOf(ObjType type) {
+  size_t counts[OBJ_TYPE_COUNT];
+  countObjects(counts);
+  return counts[(int)type];
+}
+
+TEST_F(VMTest, BoundMethodChurnTC) {
+  const char* classes = "class A { init(n) { this.n = n; } m(x) { return this.n + x; } }\n"
+                        "class B < A { m(x) { var up = super.m; return up(x) * 2; } }\n"
+                        "var objs = [];\n"
+                        "for (var i = 0; i < 100; i = i + 1) { objs.push(A(i)); objs.push(B(i)); }\n";
+  ASSERT_EQ(InterpretResult::INTERPRET_OK, interpret(classes));
+  const size_t before = objectsOf(ObjType::OBJ_BOUND_METHOD);
+
+  // Methods read into a local that is only called, over different receivers, in a block and in a function body.
+  expectChecks("var sum = 0;\n"
+               "for (var round = 0; round < 10; round = round + 1) {\n"
+               "  for (var i = 0; i < objs.len(); i = i + 1) { var f = objs[i].m; sum = sum + f(1); }\n"
+               "}\n"
+               "check(sum, 10 * 3 * 5050);\n"
+               "fun callM(obj, x) { var f = obj.m; return f(x); }\n"
+               "var total = 0;\n"
+               "for (var i = 0; i < objs.len(); i = i + 1) { total = total + callM(objs[i], 2); }\n"
+               "check(total, 3 * 5150);\n");
+  ASSERT_GE((size_t)4, objectsOf(ObjType::OBJ_BOUND_METHOD) - before);
+
+  // A bound method that is kept elsewhere is never rebound, nor one whose local is still in scope.
+  expectChecks("var kept = [];\n"
+               "for (var i = 0; i < 3; i = i + 1) { var f = objs[i * 2].m; kept.push(f); }\n"
+               "check(kept[0](0), 0);\n"
+               "check(kept[2](0), 2);\n"
+               "check(kept[0] == kept[1], false);\n"
+               // Every read of a method that is kept gives a new bound method, even for the same receiver.
+               "var same = [];\n"
+               "for (var i = 0; i < 2; i = i + 1) { same.push(objs[0].m); }\n"
+               "check(same[0] == same[1], false);\n"
+               "var o = objs[0];\n"
+               "check(o.m == o.m, false);\n"
+               "class R {\n"
+               "  init(n) { this.n = n; }\n"
+               "  m() { var f = this.rec; return f(); }\n"
+               "  rec() { if (this.n == 0) return 0; var f = R(this.n - 1).m; var inner = f(); return this.n + inner; }\n"
+               "}\n"
+               "check(R(5).m(), 15);\n");
+}
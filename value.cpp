@@ -46,7 +46,10 @@ valuesEqual(Value a, Value b) {
   if (IS_NUMBER(a) && IS_NUMBER(b)) {
     return AS_NUMBER(a) == AS_NUMBER(b);
   }
-  return a == b;
+  if (a == b) {
+    return true;
+  }
+  return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
 #else
   if (a.type != b.type) {
     return false;
@@ -59,7 +62,10 @@ valuesEqual(Value a, Value b) {
   case ValueType::VAL_NUMBER:
     return AS_NUMBER(a) == AS_NUMBER(b);
   case ValueType::VAL_OBJ:
-    return AS_OBJ(a) == AS_OBJ(b);
+    if (AS_OBJ(a) == AS_OBJ(b)) {
+      return true;
+    }
+    return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
   default:
     return false; // Unreachable.
   }
@@ -79,3 +85,10 @@ ValueArray::gcMark() {
     markValue(this->values[i]);
   }
 }
+
+void
+ValueArray::gcRelocate() {
+  for (int i = 0; i < this->values.count; i++) {
+    relocateValue(&(this->values[i]));
+  }
+}
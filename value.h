@@ -102,6 +102,9 @@ public:
   void
   gcMark();
 
+  void
+  gcRelocate();
+
   Vec<Value> values;
 };
 
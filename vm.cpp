@@ -3,8 +3,13 @@
 #include "compiler.h"
 #include "debug.h"
 #include "memory.h"
+#include "numeric.h"
 #include "object.h"
+#include "profile.h"
+#include "sampler.h"
 
+#include <atomic>
+#include <cmath>
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
@@ -12,62 +17,398 @@
 
 VM vm;
 
+static bool
+clockNative(int argCount, Value* args, Value* result) {
+  *result = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+  return true;
+}
+
+// List methods get the list itself in args[0].
+
+static bool
+listPushNative(int argCount, Value* args, Value* result) {
+  ObjList* list = AS_LIST(args[0]);
+  for (int i = 1; i < argCount; i++) {
+    list->items.push(args[i]);
+  }
+  *result = NUMBER_VAL(list->items.count);
+  return true;
+}
+
+static bool
+listPopNative(int argCount, Value* args, Value* result) {
+  ObjList* list = AS_LIST(args[0]);
+  *result = list->items.count == 0 ? NIL_VAL : list->items.pop();
+  return true;
+}
+
+static bool
+listLenNative(int argCount, Value* args, Value* result) {
+  *result = NUMBER_VAL(AS_LIST(args[0])->items.count);
+  return true;
+}
+
+/**
+ * Clamp a slice bound to [0, count]; negative bounds count from the end. A bound that is not a number, or NaN, is
+ * `otherwise`.
+ */
+static int
+sliceBound(Value bound, int count, int otherwise) {
+  if (!IS_NUMBER(bound) || std::isnan(AS_NUMBER(bound))) {
+    return otherwise;
+  }
+  double index = AS_NUMBER(bound);
+  if (index < 0) {
+    index += count;
+  }
+  if (index < 0) {
+    return 0;
+  }
+  return index > count ? count : (int)index;
+}
+
+static bool
+listSliceNative(int argCount, Value* args, Value* result) {
+  ObjList* list = AS_LIST(args[0]);
+  const int start = sliceBound(argCount > 1 ? args[1] : NIL_VAL, list->items.count, 0);
+  const int end = sliceBound(argCount > 2 ? args[2] : NIL_VAL, list->items.count, list->items.count);
+
+  ObjList* slice = newList();
+  *result = OBJ_VAL(slice);
+  for (int i = start; i < end; i++) {
+    slice->items.push(list->items[i]);
+  }
+  return true;
+}
+
+// Map methods get the map itself in args[0].
+
+static bool
+mapHasNative(int argCount, Value* args, Value* result) {
+  Value value;
+  *result = BOOL_VAL(valueTableGet(&(AS_MAP(args[0])->entries), args[1], &value));
+  return true;
+}
+
+static bool
+mapRemoveNative(int argCount, Value* args, Value* result) {
+  *result = BOOL_VAL(valueTableDelete(&(AS_MAP(args[0])->entries), args[1]));
+  return true;
+}
+
+static bool
+mapLenNative(int argCount, Value* args, Value* result) {
+  *result = NUMBER_VAL(AS_MAP(args[0])->entries.count);
+  return true;
+}
+
+static bool
+mapKeysNative(int argCount, Value* args, Value* result) {
+  ValueTable* entries = &(AS_MAP(args[0])->entries);
+  ObjList* keys = newList();
+  *result = OBJ_VAL(keys);
+  for (int i = 0; i < entries->capacity; i++) {
+    if (entries->control[i] >= 0) {
+      keys->items.push(entries->entries[i].key);
+    }
+  }
+  return true;
+}
+
+/**
+ * Float64Array(length) makes an array of zeros, Float64Array(list) copies a list of numbers.
+ */
+static bool
+float64ArrayNative(int argCount, Value* args, Value* result) {
+  if (IS_NUMBER(args[0])) {
+    const double length = AS_NUMBER(args[0]);
+    // NOTE: written so NaN fails it too, before the cast
+    if (!(length >= 0 && length <= lims::FLOAT64_ARRAY_MAX) || length != (double)(int)length) {
+      return nativeError("Float64Array length must be an integer from 0 to %d.", lims::FLOAT64_ARRAY_MAX);
+    }
+    *result = OBJ_VAL(newFloat64Array((int)length));
+    return true;
+  }
+
+  if (!IS_LIST(args[0])) {
+    return nativeError("Float64Array takes a length or a list of numbers.");
+  }
+  ObjList* list = AS_LIST(args[0]);
+  for (int i = 0; i < list->items.count; i++) {
+    if (!IS_NUMBER(list->items[i])) {
+      return nativeError("Float64Array takes a length or a list of numbers.");
+    }
+  }
+  ObjFloat64Array* array = newFloat64Array(list->items.count);
+  for (int i = 0; i < list->items.count; i++) {
+    array->values[i] = AS_NUMBER(list->items[i]);
+  }
+  *result = OBJ_VAL(array);
+  return true;
+}
+
+// Float64Array methods get the array itself in args[0]. The ones taking a second array need it to be as long.
+
+static bool
+isSameLengthArray(ObjFloat64Array* array, Value other) {
+  return IS_FLOAT64_ARRAY(other) && AS_FLOAT64_ARRAY(other)->length == array->length;
+}
+
+static bool
+float64LenNative(int argCount, Value* args, Value* result) {
+  *result = NUMBER_VAL(AS_FLOAT64_ARRAY(args[0])->length);
+  return true;
+}
+
+static bool
+float64SumNative(int argCount, Value* args, Value* result) {
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+  *result = NUMBER_VAL(sumFloat64(array->values, array->length));
+  return true;
+}
+
+static bool
+float64DotNative(int argCount, Value* args, Value* result) {
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+  if (!isSameLengthArray(array, args[1])) {
+    return nativeError("Expect a Float64Array of length %d.", array->length);
+  }
+  *result = NUMBER_VAL(dotFloat64(array->values, AS_FLOAT64_ARRAY(args[1])->values, array->length));
+  return true;
+}
+
+static bool
+float64ScaleNative(int argCount, Value* args, Value* result) {
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+  if (!IS_NUMBER(args[1])) {
+    return nativeError("Expect a number to scale by.");
+  }
+  scaleFloat64(array->values, array->length, AS_NUMBER(args[1]));
+  *result = args[0];
+  return true;
+}
+
+static bool
+float64AddNative(int argCount, Value* args, Value* result) {
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+  if (!isSameLengthArray(array, args[1])) {
+    return nativeError("Expect a Float64Array of length %d.", array->length);
+  }
+  addFloat64(array->values, AS_FLOAT64_ARRAY(args[1])->values, array->length);
+  *result = args[0];
+  return true;
+}
+
+static bool
+float64MinNative(int argCount, Value* args, Value* result) {
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+  *result = array->length == 0 ? NIL_VAL : NUMBER_VAL(minFloat64(array->values, array->length));
+  return true;
+}
+
+static bool
+float64MaxNative(int argCount, Value* args, Value* result) {
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+  *result = array->length == 0 ? NIL_VAL : NUMBER_VAL(maxFloat64(array->values, array->length));
+  return true;
+}
+
+/**
+ * Store `value` under the interned `name`; `map` must be reachable from the stack.
+ */
+static void
+setStat(ObjMap* map, const char* name, Value value) {
+  push(value);
+  push(OBJ_VAL(copyString(name, (int)strlen(name))));
+  valueTableSet(&(map->entries), vm.stack.getByNum(1), vm.stack.getByNum(2));
+  pop();
+  pop();
+}
+
 static Value
-clockNative(int argCount, Value* args) {
-  return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+millis(uint64_t nanos) {
+  return NUMBER_VAL((double)nanos / 1e6);
 }
 
+/**
+ * gcStats() returns the collector's counters as a map. Times are in milliseconds; "pauses" is the pause histogram
+ * (see GCStats) and "history" holds [liveBytes, nextGC] pairs of the last collections, oldest first.
+ */
+static bool
+gcStatsNative(int argCount, Value* args, Value* result) {
+  // Copy first: the allocations below may collect and change the counters while the map is built.
+  const GCStats stats = vm.gcStats;
+  size_t counts[OBJ_TYPE_COUNT];
+  countObjects(counts);
+  const size_t liveBytes = vm.bytesAllocated;
+  const size_t nextGC = vm.nextGC;
+
+  ObjMap* map = newMap();
+  *result = OBJ_VAL(map);
+  setStat(map, "collections", NUMBER_VAL((double)stats.collections));
+  setStat(map, "markRootsMs", millis(stats.markRootsNanos));
+  setStat(map, "traceMs", millis(stats.traceNanos));
+  setStat(map, "removeWhiteMs", millis(stats.removeWhiteNanos));
+  setStat(map, "sweepMs", millis(stats.sweepNanos));
+  setStat(map, "totalPauseMs", millis(stats.totalPauseNanos));
+  setStat(map, "lastPauseMs", millis(stats.lastPauseNanos));
+  setStat(map, "maxPauseMs", millis(stats.maxPauseNanos));
+  setStat(map, "bytesFreed", NUMBER_VAL((double)stats.bytesFreed));
+  setStat(map, "objectsFreed", NUMBER_VAL((double)stats.objectsFreed));
+  setStat(map, "compactions", NUMBER_VAL((double)stats.compactions));
+  setStat(map, "compactMs", millis(stats.compactNanos));
+  setStat(map, "objectsMoved", NUMBER_VAL((double)stats.objectsMoved));
+  setStat(map, "liveBytes", NUMBER_VAL((double)liveBytes));
+  setStat(map, "nextGC", NUMBER_VAL((double)nextGC));
+
+  ObjMap* objects = newMap();
+  setStat(map, "objects", OBJ_VAL(objects));
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+    setStat(objects, objTypeName((ObjType)i), NUMBER_VAL((double)counts[i]));
+  }
+
+  ObjList* pauses = newList();
+  setStat(map, "pauses", OBJ_VAL(pauses));
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    pauses->items.push(NUMBER_VAL((double)stats.pauseHistogram[i]));
+  }
+
+  ObjList* history = newList();
+  setStat(map, "history", OBJ_VAL(history));
+  const uint64_t first = stats.collections > GC_HISTORY_SIZE ? stats.collections - GC_HISTORY_SIZE : 0;
+  for (uint64_t n = first; n < stats.collections; n++) {
+    const GCSnapshot snapshot = stats.history[n % GC_HISTORY_SIZE];
+    ObjList* pair = newList();
+    push(OBJ_VAL(pair));
+    pair->items.push(NUMBER_VAL((double)snapshot.liveBytes));
+    pair->items.push(NUMBER_VAL((double)snapshot.nextGC));
+    history->items.push(OBJ_VAL(pair));
+    pop();
+  }
+  return true;
+}
+
+#ifdef DEBUG_PROFILE
+static bool
+profileReportNative(int argCount, Value* args, Value* result) {
+  profileReport(stderr);
+  return true;
+}
+#endif
+
 static void
 resetStack() {
   vm.stack.clear();
   vm.frames.clear();
-  vm.openUpvalues = nullptr;
+  for (int word = 0; word < lims::STACK_MAX / 64; word++) {
+    for (uint64_t bits = vm.openSlots[word]; bits != 0; bits &= bits - 1) {
+      vm.openUpvalues[word * 64 + lowestBit(bits)] = nullptr;
+    }
+    vm.openSlots[word] = 0;
+  }
 }
 
 static void
-runtimeError(const char* format, ...) {
-  va_list args;
-  va_start(args, format);
+reportError(const char* format, va_list args) {
   vfprintf(stderr, format, args);
-  va_end(args);
   fputs("\n", stderr);
 
-  CallFrame* frame = &(vm.frames.last());
-  ObjFunction* function = frame->closure->function;
-
-  size_t instruction = frame->ip - function->chunk.code.beginning() - 1;
-
-  int line = function->chunk.lines[instruction];
-  fprintf(stderr, "[line %d] in script\n", line);
-  resetStack();
-
   for (int i = vm.frames.count - 1; i >= 0; i--) {
     CallFrame* frame = &(vm.frames[i]);
+    ObjFunction* function = frame->closure->function;
     size_t instruction = frame->ip - function->chunk.code.beginning() - 1;
-    fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+    fprintf(stderr, "[line %d] in ", function->chunk.getLine((int)instruction));
     if (function->name == nullptr) {
       fprintf(stderr, "script\n");
     } else {
       fprintf(stderr, "%s()\n", function->name->chars);
     }
   }
+
+  resetStack();
 }
 
 static void
-defineNative(const char* name, NativeFn function) {
-  push(OBJ_VAL(copyString(name, (int)strlen(name))));
-  push(OBJ_VAL(newNative(function)));
-  tableSet(&(vm.globals), AS_STRING(vm.stack.first()), vm.stack.second());
-  pop();
-  pop();
+runtimeError(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  reportError(format, args);
+  va_end(args);
+}
+
+bool
+nativeError(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  reportError(format, args);
+  va_end(args);
+  return false;
 }
 
+void
+defineNatives(Table* table, const NativeDef* natives, int count) {
+  for (int i = 0; i < count; i++) {
+    const NativeDef* native = &(natives[i]);
+    push(OBJ_VAL(copyString(native->name, (int)strlen(native->name))));
+    push(OBJ_VAL(newNative(native->function, native->minArity, native->maxArity)));
+    tableSet(table, AS_STRING(vm.stack.getByNum(2)), vm.stack.getByNum(1));
+    pop();
+    pop();
+  }
+}
+
+// clang-format off
+static const NativeDef globalNatives[] = {
+  {"clock",         clockNative,         0, 0},
+  {"Float64Array",  float64ArrayNative,  1, 1},
+  {"gcStats",       gcStatsNative,       0, 0},
+#ifdef DEBUG_PROFILE
+  {"profileReport", profileReportNative, 0, 0},
+#endif
+};
+
+static const NativeDef listNatives[] = {
+  {"push",  listPushNative,  1, NATIVE_VARIADIC},
+  {"pop",   listPopNative,   0, 0},
+  {"len",   listLenNative,   0, 0},
+  {"slice", listSliceNative, 0, 2},
+};
+
+static const NativeDef mapNatives[] = {
+  {"has",    mapHasNative,    1, 1},
+  {"remove", mapRemoveNative, 1, 1},
+  {"len",    mapLenNative,    0, 0},
+  {"keys",   mapKeysNative,   0, 0},
+};
+
+static const NativeDef float64ArrayNatives[] = {
+  {"len",   float64LenNative,   0, 0},
+  {"sum",   float64SumNative,   0, 0},
+  {"dot",   float64DotNative,   1, 1},
+  {"scale", float64ScaleNative, 1, 1},
+  {"add",   float64AddNative,   1, 1},
+  {"min",   float64MinNative,   0, 0},
+  {"max",   float64MaxNative,   0, 0},
+};
+// clang-format on
+
+#define NATIVE_COUNT(natives) ((int)(sizeof(natives) / sizeof(NativeDef)))
+
 void
 initVM() {
+  const GCConfig config = defaultGCConfig();
+  initVM(&config);
+}
+
+void
+initVM(const GCConfig* config) {
   resetStack();
-  vm.objects = nullptr;
+  initHeap(&(vm.heap));
   vm.bytesAllocated = 0;
-  vm.nextGC = 1024 * 1024;
+  vm.gcConfig = *config;
+  vm.nextGC = config->initialThreshold;
+  vm.compactPending = false;
+  resetGCStats(&(vm.gcStats));
 
   vm.grayCount = 0;
   vm.grayCapacity = 0;
@@ -75,17 +416,29 @@ initVM() {
 
   initTable(&(vm.globals));
   initTable(&(vm.strings));
+  initTable(&(vm.listMethods));
+  initTable(&(vm.mapMethods));
+  initTable(&(vm.float64ArrayMethods));
 
   vm.initString = nullptr;
   vm.initString = copyString("init", 4);
 
-  defineNative("clock", clockNative);
+  defineNatives(&(vm.globals), globalNatives, NATIVE_COUNT(globalNatives));
+  defineNatives(&(vm.listMethods), listNatives, NATIVE_COUNT(listNatives));
+  defineNatives(&(vm.mapMethods), mapNatives, NATIVE_COUNT(mapNatives));
+  defineNatives(&(vm.float64ArrayMethods), float64ArrayNatives, NATIVE_COUNT(float64ArrayNatives));
 }
 
 void
 freeVM() {
+#ifdef DEBUG_PROFILE
+  profileReport(stderr);
+#endif
   freeTable(&(vm.globals));
   freeTable(&(vm.strings));
+  freeTable(&(vm.listMethods));
+  freeTable(&(vm.mapMethods));
+  freeTable(&(vm.float64ArrayMethods));
   vm.initString = nullptr;
   freeObjects();
 }
@@ -117,13 +470,44 @@ call(ObjClosure* closure, int argCount) {
     return false;
   }
 
-  CallFrame* frame = &(vm.frames.increaseCount());
+  if (closure->function->bodySource != nullptr && !compileFunctionBody(closure->function)) {
+    runtimeError("Could not compile '%s'.", closure->function->name->chars);
+    return false;
+  }
+
+  // NOTE: fill the frame in before counting it, the sampler's signal handler may look at it at any time
+  CallFrame* frame = &(vm.frames[vm.frames.count]);
   frame->closure = closure;
   frame->ip = closure->function->chunk.code.beginning();
   frame->slots = vm.stack.getAddressByNum(argCount + 1);
+  std::atomic_signal_fence(std::memory_order_release);
+  vm.frames.increaseCount();
+
+  if (samplerBacklogged()) {
+    drainSamples();
+  }
   return true;
 }
 
+/**
+ * Whether a call of `native` may pass `argCount` arguments; reports the runtime error when not.
+ */
+static inline bool
+checkNativeArity(ObjNative* native, int argCount) {
+  // NOTE: one unsigned compare covers both bounds, NATIVE_VARIADIC wraps around to the largest maxArity
+  if ((unsigned)(argCount - native->minArity) <= (unsigned)(native->maxArity - native->minArity)) {
+    return true;
+  }
+  if (native->maxArity == NATIVE_VARIADIC) {
+    runtimeError("Expect at least %d arguments but got %d.", native->minArity, argCount);
+  } else if (native->minArity == native->maxArity) {
+    runtimeError("Expect %d arguments but got %d.", native->minArity, argCount);
+  } else {
+    runtimeError("Expect %d to %d arguments but got %d.", native->minArity, native->maxArity, argCount);
+  }
+  return false;
+}
+
 static bool
 callValue(Value callee, int argCount) {
   if (IS_OBJ(callee)) {
@@ -147,10 +531,14 @@ callValue(Value callee, int argCount) {
     case ObjType::OBJ_CLOSURE:
       return call(AS_CLOSURE(callee), argCount);
     case ObjType::OBJ_NATIVE: {
-      NativeFn native = AS_NATIVE(callee);
-      Value result = native(argCount, vm.stack.getAddressByNum(argCount));
-      vm.stack.shrinkBySize(argCount + 1);
-      push(result);
+      // The result goes to the callee's slot, which is where the call leaves it.
+      ObjNative* native = AS_NATIVE(callee);
+      Value* args = vm.stack.getAddressByNum(argCount);
+      args[-1] = NIL_VAL;
+      if (!checkNativeArity(native, argCount) || !native->function(argCount, args, args - 1)) {
+        return false;
+      }
+      vm.stack.shrinkBySize(argCount);
       return true;
     }
     default:
@@ -171,10 +559,45 @@ invokeFromClass(ObjClass* klass, ObjString* name, int argCount) {
   return call(AS_CLOSURE(method), argCount);
 }
 
+static bool
+invokeNative(Table* methods, const char* kind, ObjString* name, int argCount) {
+  Value method;
+  if (!tableGet(methods, name, &method)) {
+    runtimeError("Undefined %s method '%s'.", kind, name->chars);
+    return false;
+  }
+
+  ObjNative* native = AS_NATIVE(method);
+  if (!checkNativeArity(native, argCount)) {
+    return false;
+  }
+
+  // The receiver is passed as the first argument. The result goes to a slot above the arguments, then to the
+  // receiver's.
+  push(NIL_VAL);
+  Value* args = vm.stack.getAddressByNum(argCount + 2);
+  if (!native->function(argCount + 1, args, args + argCount + 1)) {
+    return false;
+  }
+  args[0] = args[argCount + 1];
+  vm.stack.shrinkBySize(argCount + 1);
+  return true;
+}
+
 static bool
 invoke(ObjString* name, int argCount) {
   Value receiver = peek(argCount);
 
+  if (IS_LIST(receiver)) {
+    return invokeNative(&(vm.listMethods), "list", name, argCount);
+  }
+  if (IS_MAP(receiver)) {
+    return invokeNative(&(vm.mapMethods), "map", name, argCount);
+  }
+  if (IS_FLOAT64_ARRAY(receiver)) {
+    return invokeNative(&(vm.float64ArrayMethods), "Float64Array", name, argCount);
+  }
+
   if (!IS_INSTANCE(receiver)) {
     runtimeError("Only instances have methods");
     return false;
@@ -191,52 +614,109 @@ invoke(ObjString* name, int argCount) {
   return invokeFromClass(instance->klass, name, argCount);
 }
 
+/**
+ * Replace the instance on top of the stack by `method` bound to it. Each read makes a new bound method, except at a
+ * reusable site: `cache`, its slot of Chunk::bindings, keeps the last one, which is rebound once the local it was left
+ * in has gone.
+ */
+static void
+bindMethod(ObjClosure* method, BindingCache* cache) {
+  const int slot = (int)(vm.stack.top() - 1 - vm.stack.bottom());
+  ObjBoundMethod* cached = cache->bound;
+  if (cached != nullptr) {
+    // NOTE: that local is the only place the bound method was ever kept, so no one can tell it is the same object
+    const Value* held = vm.stack.bottom() + cache->slot;
+    if (held >= vm.stack.top() || !IS_BOUND_METHOD(*held) || AS_BOUND_METHOD(*held) != cached) {
+      cached->receiver = peek(0);
+      cached->method = method;
+      cache->slot = slot;
+      pop();
+      push(OBJ_VAL(cached));
+      return;
+    }
+  }
+
+  ObjBoundMethod* bound = newBoundMethod(peek(0), method);
+  if (cache->reusable) {
+    cache->bound = bound;
+    cache->slot = slot;
+  }
+  pop();
+  push(OBJ_VAL(bound));
+}
+
 static bool
-bindMethod(ObjClass* klass, ObjString* name) {
-  Value method;
-  if (!tableGet(&(klass->methods), name, &method)) {
+findMethod(ObjClass* klass, ObjString* name, ObjClosure** method) {
+  Value value;
+  if (!tableGet(&(klass->methods), name, &value)) {
     runtimeError("Undefined property '%s'.", name->chars);
     return false;
   }
+  *method = AS_CLOSURE(value);
+  return true;
+}
 
-  ObjBoundMethod* bound = newBoundMethod(peek(0), AS_CLOSURE(method));
-  pop();
-  push(OBJ_VAL(bound));
+/**
+ * findMethod() on the superclass of a super call site, through the site's slot of Chunk::superCaches.
+ */
+static bool
+findSuperMethod(ObjClass* superclass, ObjString* name, SuperCache* cache, ObjClosure** method) {
+  if (cache->superclass == superclass && cache->name == name) {
+    *method = cache->method;
+    return true;
+  }
+  if (!findMethod(superclass, name, method)) {
+    return false;
+  }
+  *cache = SuperCache{superclass, name, *method};
   return true;
 }
 
 static ObjUpvalue*
 captureUpvalue(Value* local) {
-  ObjUpvalue* prevUpvalue = nullptr;
-  ObjUpvalue* upvalue = vm.openUpvalues;
-  while (upvalue != nullptr && upvalue->location > local) { // NOTE: pointer address comparison
-    prevUpvalue = upvalue;
-    upvalue = upvalue->next;
-  }
-
-  if (upvalue != nullptr && upvalue->location == local) { // NOTE: pointer address comparison
-    return upvalue;
+  const int slot = (int)(local - vm.stack.bottom());
+  if (vm.openUpvalues[slot] != nullptr) {
+    return vm.openUpvalues[slot];
   }
 
-  ObjUpvalue* createdUpvalue = newUpvalue(local);
-  createdUpvalue->next = upvalue;
-
-  if (prevUpvalue == nullptr) {
-    vm.openUpvalues = createdUpvalue;
-  } else {
-    prevUpvalue->next = createdUpvalue;
-  }
+  ObjUpvalue* upvalue = newUpvalue(local);
+  vm.openUpvalues[slot] = upvalue;
+  vm.openSlots[slot >> 6] |= uint64_t{1} << (slot & 63);
+  return upvalue;
+}
 
-  return createdUpvalue;
+/**
+ * An upvalue that holds its own copy of `value` from the start; it is never open. The value must be
+ * reachable elsewhere, as a local on the stack is.
+ */
+static ObjUpvalue*
+closedUpvalue(Value value) {
+  ObjUpvalue* upvalue = newUpvalue(nullptr);
+  upvalue->closed = value;
+  upvalue->location = &(upvalue->closed);
+  return upvalue;
 }
 
+/**
+ * Close the open upvalues of `last` and every slot above it up to the top of the stack.
+ */
 static void
 closeUpvalues(Value* last) {
-  while (vm.openUpvalues != nullptr && vm.openUpvalues->location >= last) { // NOTE: pointer address comparison
-    ObjUpvalue* upvalue = vm.openUpvalues;
-    upvalue->closed = *(upvalue->location); // NOTE: value copy
-    upvalue->location = &(upvalue->closed);
-    vm.openUpvalues = upvalue->next;
+  const int from = (int)(last - vm.stack.bottom());
+  const int to = (int)(vm.stack.top() - vm.stack.bottom());
+  for (int word = from >> 6; word * 64 < to; word++) {
+    uint64_t bits = vm.openSlots[word];
+    if (word == from >> 6) {
+      bits &= ~uint64_t{0} << (from & 63);
+    }
+    vm.openSlots[word] &= ~bits;
+    for (; bits != 0; bits &= bits - 1) {
+      const int slot = word * 64 + lowestBit(bits);
+      ObjUpvalue* upvalue = vm.openUpvalues[slot];
+      upvalue->closed = *(upvalue->location); // NOTE: value copy
+      upvalue->location = &(upvalue->closed);
+      vm.openUpvalues[slot] = nullptr;
+    }
   }
 }
 
@@ -244,6 +724,14 @@ static void
 defineMethod(ObjString* name) {
   Value method = peek(0);
   ObjClass* klass = AS_CLASS(peek(1));
+  if (klass->sharesMethods) {
+    // Copy on write. Until the copy is done, the inherited methods stay reachable through the superclass.
+    Table methods;
+    initTable(&methods);
+    tableAddAll(&(klass->methods), &methods);
+    klass->methods = methods;
+    klass->sharesMethods = false;
+  }
   tableSet(&(klass->methods), name, method);
   pop();
 }
@@ -253,23 +741,50 @@ isFalsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+/**
+ * Check that `index` is an integer in [0, length) and store it in `slot`.
+ */
+static bool
+checkIndex(Value index, int length, int* slot) {
+  if (!IS_NUMBER(index)) {
+    runtimeError("Index must be a number.");
+    return false;
+  }
+
+  const double number = AS_NUMBER(index);
+  // NOTE: written so NaN fails it too, before the cast
+  if (!(number >= 0 && number < length) || number != (double)(int)number) {
+    runtimeError("Index %g is out of range [0, %d).", number, length);
+    return false;
+  }
+
+  *slot = (int)number;
+  return true;
+}
+
 static void
 concatenate() {
   ObjString* b = AS_STRING(peek(0));
   ObjString* a = AS_STRING(peek(1));
 
-  int length = a->length + b->length;
-  char* chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
-
-  ObjString* result = takeString(chars, length);
+  ObjString* result = concatenateStrings(a, b);
   pop();
   pop();
   push(OBJ_VAL(result));
 }
 
+/**
+ * Compact the heap between two instructions. Loops and calls are the safepoints: there run() holds no object pointers
+ * but the roots, `frame` points into vm.frames, and no compilation is in progress.
+ */
+static void
+compactAtSafepoint() {
+#ifdef DEBUG_PROFILE
+  profileStop(); // it holds on to the function of the last instruction
+#endif
+  compactGarbage();
+}
+
 static InterpretResult
 run() {
   CallFrame* frame = &(vm.frames.last());
@@ -301,6 +816,10 @@ run() {
                            (int)(frame->ip - frame->closure->function->chunk.code.beginning()));
 #endif
 
+#ifdef DEBUG_PROFILE
+    profileInstruction(frame->closure->function, (int)(frame->ip - frame->closure->function->chunk.code.beginning()));
+#endif
+
     uint8_t byte = READ_BYTE();
     OpCode instruction{u8ToOpCode(byte)};
     switch (instruction) {
@@ -378,6 +897,7 @@ run() {
 
       ObjInstance* instance = AS_INSTANCE(peek(0));
       ObjString* name = READ_STRING();
+      BindingCache* cache = &(frame->closure->function->chunk.bindings[READ_BYTE()]);
 
       Value value;
       if (tableGet(&(instance->fields), name, &value)) {
@@ -386,9 +906,11 @@ run() {
         break;
       }
 
-      if (!bindMethod(instance->klass, name)) {
+      ObjClosure* method;
+      if (!findMethod(instance->klass, name, &method)) {
         return InterpretResult::INTERPRET_RUNTIME_ERROR;
       }
+      bindMethod(method, cache);
       break;
     }
     case OpCode::OP_SET_PROPERTY: {
@@ -406,17 +928,125 @@ run() {
     }
     case OpCode::OP_GET_SUPER: {
       ObjString* name = READ_STRING();
+      BindingCache* cache = &(frame->closure->function->chunk.bindings[READ_BYTE()]);
+      SuperCache* superCache = &(frame->closure->function->chunk.superCaches[READ_BYTE()]);
       ObjClass* superclass = AS_CLASS(pop());
 
-      if (!bindMethod(superclass, name)) {
+      ObjClosure* method;
+      if (!findSuperMethod(superclass, name, superCache, &method)) {
         return InterpretResult::INTERPRET_RUNTIME_ERROR;
       }
+      bindMethod(method, cache);
+      break;
+    }
+    case OpCode::OP_BUILD_LIST: {
+      int itemCount = READ_BYTE();
+      ObjList* list = newList();
+      push(OBJ_VAL(list));
+      for (int i = itemCount; i > 0; i--) {
+        list->items.push(peek(i));
+      }
+      vm.stack.shrinkBySize(itemCount + 1);
+      push(OBJ_VAL(list));
+      break;
+    }
+    case OpCode::OP_BUILD_MAP: {
+      int entryCount = READ_BYTE();
+      ObjMap* map = newMap();
+      push(OBJ_VAL(map));
+      for (int i = entryCount * 2; i > 0; i -= 2) {
+        valueTableSet(&(map->entries), peek(i), peek(i - 1));
+      }
+      vm.stack.shrinkBySize(entryCount * 2 + 1);
+      push(OBJ_VAL(map));
+      break;
+    }
+    case OpCode::OP_INDEX_GET: {
+      if (IS_MAP(peek(1))) {
+        Value value;
+        if (!valueTableGet(&(AS_MAP(peek(1))->entries), peek(0), &value)) {
+          value = NIL_VAL;
+        }
+        pop();
+        pop();
+        push(value);
+        break;
+      }
+      if (IS_FLOAT64_ARRAY(peek(1))) {
+        ObjFloat64Array* array = AS_FLOAT64_ARRAY(peek(1));
+        int slot;
+        if (!checkIndex(peek(0), array->length, &slot)) {
+          return InterpretResult::INTERPRET_RUNTIME_ERROR;
+        }
+        pop();
+        pop();
+        push(NUMBER_VAL(array->values[slot]));
+        break;
+      }
+      if (!IS_LIST(peek(1))) {
+        runtimeError("Only lists, maps and arrays can be indexed.");
+        return InterpretResult::INTERPRET_RUNTIME_ERROR;
+      }
+
+      ObjList* list = AS_LIST(peek(1));
+      int slot;
+      if (!checkIndex(peek(0), list->items.count, &slot)) {
+        return InterpretResult::INTERPRET_RUNTIME_ERROR;
+      }
+      pop();
+      pop();
+      push(list->items[slot]);
+      break;
+    }
+    case OpCode::OP_INDEX_SET: {
+      if (IS_MAP(peek(2))) {
+        valueTableSet(&(AS_MAP(peek(2))->entries), peek(1), peek(0));
+        Value value = pop();
+        pop();
+        pop();
+        push(value);
+        break;
+      }
+      if (IS_FLOAT64_ARRAY(peek(2))) {
+        ObjFloat64Array* array = AS_FLOAT64_ARRAY(peek(2));
+        int slot;
+        if (!checkIndex(peek(1), array->length, &slot)) {
+          return InterpretResult::INTERPRET_RUNTIME_ERROR;
+        }
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Float64Array elements must be numbers.");
+          return InterpretResult::INTERPRET_RUNTIME_ERROR;
+        }
+        array->values[slot] = AS_NUMBER(peek(0));
+        Value value = pop();
+        pop();
+        pop();
+        push(value);
+        break;
+      }
+      if (!IS_LIST(peek(2))) {
+        runtimeError("Only lists, maps and arrays can be indexed.");
+        return InterpretResult::INTERPRET_RUNTIME_ERROR;
+      }
+
+      ObjList* list = AS_LIST(peek(2));
+      int slot;
+      if (!checkIndex(peek(1), list->items.count, &slot)) {
+        return InterpretResult::INTERPRET_RUNTIME_ERROR;
+      }
+      list->items[slot] = peek(0);
+      Value value = pop();
+      pop();
+      pop();
+      push(value);
       break;
     }
     case OpCode::OP_EQUAL: {
-      Value b = pop();
-      Value a = pop();
-      push(BOOL_VAL(valuesEqual(a, b)));
+      // Comparing ropes flattens them, so keep both operands on the stack until it is done.
+      bool equal = valuesEqual(peek(1), peek(0));
+      pop();
+      pop();
+      push(BOOL_VAL(equal));
       break;
     }
     case OpCode::OP_GREATER: {
@@ -465,8 +1095,10 @@ run() {
       break;
     }
     case OpCode::OP_PRINT: {
-      printValue(pop());
+      // Printing a list may flatten the ropes in it, so keep it on the stack.
+      printValue(peek(0));
       printf("\n");
+      pop();
       break;
     }
     case OpCode::OP_JUMP: {
@@ -484,6 +1116,13 @@ run() {
     case OpCode::OP_LOOP: {
       uint16_t offset = READ_SHORT();
       frame->ip -= offset;
+      if (vm.compactPending) {
+        compactAtSafepoint();
+      }
+      // NOTE: a loop that makes no calls would never drain the samples otherwise
+      if (samplerBacklogged()) {
+        drainSamples();
+      }
       break;
     }
     case OpCode::OP_CALL: {
@@ -492,6 +1131,9 @@ run() {
         return InterpretResult::INTERPRET_RUNTIME_ERROR;
       }
       frame = &(vm.frames.last());
+      if (vm.compactPending) {
+        compactAtSafepoint();
+      }
       break;
     }
     case OpCode::OP_INVOKE: {
@@ -506,8 +1148,10 @@ run() {
     case OpCode::OP_SUPER_INVOKE: {
       ObjString* method = READ_STRING();
       int argCount = READ_BYTE();
+      SuperCache* cache = &(frame->closure->function->chunk.superCaches[READ_BYTE()]);
       ObjClass* superclass = AS_CLASS(pop());
-      if (!invokeFromClass(superclass, method, argCount)) {
+      ObjClosure* closure;
+      if (!findSuperMethod(superclass, method, cache, &closure) || !call(closure, argCount)) {
         return InterpretResult::INTERPRET_RUNTIME_ERROR;
       }
       frame = &(vm.frames.last());
@@ -518,12 +1162,18 @@ run() {
       ObjClosure* closure = newClosure(function);
       push(OBJ_VAL(closure));
       for (int i = 0; i < closure->upvalueCount; i++) {
-        uint8_t isLocal = READ_BYTE();
+        const Capture capture = static_cast<Capture>(READ_BYTE());
         uint8_t index = READ_BYTE();
-        if (isLocal) {
-          closure->upvalues[i] = captureUpvalue(frame->slots + index);
-        } else {
+        switch (capture) {
+        case Capture::CAPTURE_UPVALUE:
           closure->upvalues[i] = frame->closure->upvalues[index];
+          break;
+        case Capture::CAPTURE_LOCAL:
+          closure->upvalues[i] = captureUpvalue(frame->slots + index);
+          break;
+        case Capture::CAPTURE_VALUE:
+          closure->upvalues[i] = closedUpvalue(frame->slots[index]);
+          break;
         }
       }
 
@@ -559,8 +1209,11 @@ run() {
         return InterpretResult::INTERPRET_RUNTIME_ERROR;
       }
 
+      // NOTE: the subclass has no methods yet, its table is still empty
       ObjClass* subclass = AS_CLASS(peek(0));
-      tableAddAll(&(AS_CLASS(superclass)->methods), &(subclass->methods));
+      subclass->superclass = AS_CLASS(superclass);
+      subclass->methods = subclass->superclass->methods;
+      subclass->sharesMethods = true;
       pop(); // Subclass.
       break;
     }
@@ -578,9 +1231,8 @@ run() {
 #undef BINARY_OP
 }
 
-InterpretResult
-interpret(const char* source) {
-  ObjFunction* function = compile(source);
+static InterpretResult
+runScript(ObjFunction* function) {
   if (function == nullptr) {
     return InterpretResult::INTERPRET_COMPILE_ERROR;
   }
@@ -591,5 +1243,43 @@ interpret(const char* source) {
   push(OBJ_VAL(closure));
   call(closure, 0);
 
-  return run();
+  InterpretResult result = run();
+#ifdef DEBUG_PROFILE
+  profileStop();
+#endif
+  return result;
+}
+
+static InterpretResult
+outOfMemory(const OutOfMemory& error) {
+  abortCompilation();
+  resetPrinting();
+  if (error.heapLimit != 0) {
+    runtimeError("Out of memory: %zu more bytes would exceed the heap limit of %zu bytes.", error.requested,
+                 error.heapLimit);
+  } else {
+    runtimeError("Out of memory: could not allocate %zu bytes.", error.requested);
+  }
+#ifdef DEBUG_PROFILE
+  profileStop();
+#endif
+  return InterpretResult::INTERPRET_RUNTIME_ERROR;
+}
+
+InterpretResult
+interpret(const char* source) {
+  try {
+    return runScript(compile(source));
+  } catch (const OutOfMemory& error) {
+    return outOfMemory(error);
+  }
+}
+
+InterpretResult
+interpret(Source* source) {
+  try {
+    return runScript(compile(source));
+  } catch (const OutOfMemory& error) {
+    return outOfMemory(error);
+  }
 }
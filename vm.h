@@ -4,8 +4,11 @@
 #include "chunk.h"
 #include "collections/Arr.h"
 #include "collections/ArrStack.h"
+#include "heap.h"
 #include "lims.h"
+#include "memory.h"
 #include "object.h"
+#include "source.h"
 #include "table.h"
 #include "value.h"
 
@@ -20,13 +23,24 @@ struct VM {
   ArrStack<Value, lims::STACK_MAX> stack;
   Table globals;
   Table strings;
+  Table listMethods;
+  Table mapMethods;
+  Table float64ArrayMethods;
   ObjString* initString;
-  ObjUpvalue* openUpvalues;
+
+  // The open upvalues by the stack slot they point at, nullptr where there is none; a set bit in `openSlots` marks each
+  // slot that has one, so closing the upvalues above a slot only looks at the bitmap words of the slots above it.
+  ObjUpvalue* openUpvalues[lims::STACK_MAX];
+  uint64_t openSlots[lims::STACK_MAX / 64];
+  static_assert(lims::STACK_MAX % 64 == 0, "every slot must have a bit in openSlots");
 
   size_t bytesAllocated;
   size_t nextGC;
+  bool compactPending; // set by the sweep, done by run() at its next safepoint
+  GCConfig gcConfig;
+  GCStats gcStats;
 
-  Obj* objects;
+  Heap heap;
   int grayCount;
   int grayCapacity;
   Obj** grayStack;
@@ -43,16 +57,46 @@ extern VM vm;
 void
 initVM();
 
+void
+initVM(const GCConfig* config);
+
 void
 freeVM();
 
 InterpretResult
 interpret(const char* source);
 
+InterpretResult
+interpret(Source* source);
+
 void
 push(Value value);
 
 Value
 pop();
 
+/**
+ * A native function to register: calls must pass from `minArity` to `maxArity` arguments (NATIVE_VARIADIC for no
+ * limit). See NativeFn.
+ */
+struct NativeDef {
+  const char* name;
+  NativeFn function;
+  int minArity;
+  int maxArity;
+};
+
+/**
+ * Store `count` natives in `table`: vm.globals for functions, or one of the method tables. A host calls it after
+ * initVM().
+ */
+void
+defineNatives(Table* table, const NativeDef* natives, int count);
+
+/**
+ * Report a runtime error from a native function, which then returns the false this returns.
+ */
+bool
+nativeError(const char* format, ...);
+
 #endif